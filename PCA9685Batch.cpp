@@ -0,0 +1,90 @@
+/*!
+ *  @file PCA9685Batch.cpp
+ *
+ *  BSD license, all text above must be included in any redistribution
+ */
+
+#include "PCA9685Batch.h"
+
+/*!
+ *  @brief  Instantiates an empty batch over caller storage
+ *  @param  segments Segment array
+ *  @param  capacity Number of segments in it
+ *  @param  buffer   Storage for write data
+ *  @param  size     Bytes of buffer
+ */
+PCA9685Batch::PCA9685Batch(PCA9685Segment *segments, uint8_t capacity,
+                           char *buffer, uint16_t size)
+    : _segments(segments), _buffer(buffer), _size(size), _used(0),
+      _capacity(capacity), _count(0) {}
+
+/*!
+ *  @brief  Adds a write and reserves its data in the batch buffer
+ *  @param  addr     8-bit address
+ *  @param  length   Bytes to write, register address included
+ *  @param  repeated Keep the bus for the next segment
+ *  @return where to put the bytes, or NULL if the batch is full
+ */
+char *PCA9685Batch::write(uint8_t addr, uint8_t length, bool repeated) {
+  if (!fits(1, length))
+    return NULL;
+  PCA9685Segment &seg = _segments[_count++];
+  seg.data = _buffer + _used;
+  seg.addr = addr;
+  seg.length = length;
+  seg.flags = repeated ? PCA9685_SEGMENT_REPEATED : 0;
+  seg.acked = false;
+  _used += length;
+  return seg.data;
+}
+
+/*!
+ *  @brief  Adds a read
+ *  @param  addr     8-bit address
+ *  @param  data     Where the bytes go; must stay valid until submit()
+ *  @param  length   Bytes to read
+ *  @param  repeated Keep the bus for the next segment
+ *  @return false if the batch is full
+ */
+bool PCA9685Batch::read(uint8_t addr, char *data, uint8_t length,
+                        bool repeated) {
+  if (!fits(1, 0))
+    return false;
+  PCA9685Segment &seg = _segments[_count++];
+  seg.data = data;
+  seg.addr = addr;
+  seg.length = length;
+  seg.flags = PCA9685_SEGMENT_READ | (repeated ? PCA9685_SEGMENT_REPEATED : 0);
+  seg.acked = false;
+  return true;
+}
+
+/*!
+ *  @brief  Runs every segment in order while holding the bus lock
+ *  @param  i2c Bus to run them on
+ *  @return number of segments that were not acknowledged
+ */
+int PCA9685Batch::submit(I2C &i2c) {
+  int failed = 0;
+  bool chained_ok = true; // whether the segment holding the bus succeeded
+
+  i2c.lock();
+  for (uint8_t i = 0; i < _count; i++) {
+    PCA9685Segment &seg = _segments[i];
+    bool repeated = seg.flags & PCA9685_SEGMENT_REPEATED;
+    if (chained_ok) {
+      int nack = (seg.flags & PCA9685_SEGMENT_READ)
+                     ? i2c.read(seg.addr, seg.data, seg.length, repeated)
+                     : i2c.write(seg.addr, seg.data, seg.length, repeated);
+      seg.acked = !nack;
+      if (nack && repeated)
+        i2c.stop(); // nothing will follow on this start
+    } else {
+      seg.acked = false;
+    }
+    failed += !seg.acked;
+    chained_ok = !repeated || seg.acked;
+  }
+  i2c.unlock();
+  return failed;
+}
@@ -0,0 +1,84 @@
+/*!
+ *  @file PCA9685Batch.h
+ *
+ *  Scatter-gather I2C transfers: a list of read and write segments to any
+ *  addresses, submitted as one locked sequence.
+ *
+ *  BSD license, all text above must be included in any redistribution
+ */
+#ifndef _PCA9685_BATCH_H
+#define _PCA9685_BATCH_H
+
+#include "mbed_PWMServoDriver.h"
+
+#define PCA9685_SEGMENT_READ 0x01 /**< segment reads instead of writing */
+#define PCA9685_SEGMENT_REPEATED 0x02 /**< no STOP; repeated start follows */
+
+/*!
+ *  @brief  One transfer of a batch
+ */
+struct PCA9685Segment {
+  char *data;     /**< bytes to write, or room for the bytes read */
+  uint8_t addr;   /**< 8-bit address */
+  uint8_t length; /**< bytes */
+  uint8_t flags;  /**< PCA9685_SEGMENT_READ, PCA9685_SEGMENT_REPEATED */
+  bool acked;     /**< set by PCA9685Batch::submit() */
+};
+
+/*!
+ *  @brief  Collects transfer segments for several chips and runs them as
+ * one submission.
+ *
+ *  Segments and write data live in storage the caller provides, so a whole
+ *  frame (bursts to some chips, a readback from another) is planned without
+ *  allocating and sent while holding the bus lock once. A segment flagged
+ *  PCA9685_SEGMENT_REPEATED keeps the bus for the next one, e.g. a register
+ *  pointer write followed by its read; if it fails, the segment it leads to
+ *  fails without being attempted. Other segments run regardless of earlier
+ *  failures, and each reports its own acknowledgement.
+ */
+class PCA9685Batch {
+public:
+  PCA9685Batch(PCA9685Segment *segments, uint8_t capacity, char *buffer,
+               uint16_t size);
+  char *write(uint8_t addr, uint8_t length, bool repeated = false);
+  bool read(uint8_t addr, char *data, uint8_t length, bool repeated = false);
+  /*!
+   *  @brief  Whether more segments and write bytes still fit
+   *  @param  segments Segments to add
+   *  @param  bytes    Write data they need
+   *  @return true if write() and read() will succeed for them
+   */
+  bool fits(uint8_t segments, uint16_t bytes) const {
+    return _count + segments <= _capacity && _used + bytes <= _size;
+  }
+  int submit(I2C &i2c);
+  /*!
+   *  @brief  Empties the batch for reuse
+   */
+  void clear() {
+    _count = 0;
+    _used = 0;
+  }
+  /*!
+   *  @brief  Number of segments added
+   *  @return segment count
+   */
+  uint8_t count() const { return _count; }
+  /*!
+   *  @brief  A segment, e.g. to check whether it was acknowledged
+   *  @param  i Index in the order the segments were added
+   *  @return the segment
+   */
+  const PCA9685Segment &segment(uint8_t i) const { return _segments[i]; }
+
+private:
+  PCA9685Segment *_segments;
+  char *_buffer;
+  uint16_t _size;
+  uint16_t _used;
+  uint8_t _capacity;
+  uint8_t _count;
+};
+
+#endif
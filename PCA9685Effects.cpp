@@ -0,0 +1,168 @@
+/*!
+ *  @file PCA9685Effects.cpp
+ *
+ *  BSD license, all text above must be included in any redistribution
+ */
+
+#include "mbed_PWMServoDriver.h"
+#if PCA9685_ENABLE_EFFECTS
+#include "PCA9685Effects.h"
+
+/* First quarter of a sine wave, 32767 * sin(k * pi / 128) */
+static const uint16_t QUARTER_SINE[65] = {
+    0,     804,   1608,  2410,  3212,  4011,  4808,  5602,  6393,  7179,
+    7962,  8739,  9512,  10278, 11039, 11793, 12539, 13279, 14010, 14732,
+    15446, 16151, 16846, 17530, 18204, 18868, 19519, 20159, 20787, 21403,
+    22005, 22594, 23170, 23731, 24279, 24811, 25329, 25832, 26319, 26790,
+    27245, 27683, 28105, 28510, 28898, 29268, 29621, 29956, 30273, 30571,
+    30852, 31113, 31356, 31580, 31785, 31971, 32137, 32285, 32412, 32521,
+    32609, 32678, 32728, 32757, 32767};
+
+/* Maps a 0..65535 fraction onto low..high, levels above 4095 taken as 4095;
+ * high may be below low, which runs the effect the other way up. */
+static inline uint16_t scale(uint16_t v, uint16_t low, uint16_t high) {
+  int32_t from = low > 4095 ? 4095 : low, to = high > 4095 ? 4095 : high;
+  return from + (((to - from) * (int32_t)v + 0x8000) >> 16);
+}
+
+/*!
+ *  @brief  Instantiates effects over a range of fleet channels
+ *  @param  fleet Fleet to render into
+ *  @param  first First channel, chip * 16 + channel
+ *  @param  count Number of channels; the range is cut at the end of the
+ * fleet's shadow
+ *  @param  seed  Non-zero seed of the twinkle() random generator
+ */
+PCA9685Effects::PCA9685Effects(PCA9685Fleet &fleet, uint16_t first,
+                               uint16_t count, uint32_t seed)
+    : _fleet(&fleet), _first(first), _count(count), _rng(seed ? seed : 1) {
+  if (first >= PCA9685_FLEET_CHANNELS)
+    _count = 0;
+  else if (count > PCA9685_FLEET_CHANNELS - first)
+    _count = PCA9685_FLEET_CHANNELS - first;
+}
+
+/*!
+ *  @brief  Table sine with linear interpolation
+ *  @param  phase 16-bit angle
+ *  @return 32768 + 32767 * sin(phase), within 3 counts of the exact value
+ */
+uint16_t PCA9685Effects::sine(uint16_t phase) {
+  uint16_t p = phase & 0x3FFF;
+  if (phase & 0x4000)
+    p = 0x4000 - p;
+  uint8_t k = p >> 8, frac = p & 0xFF;
+  uint16_t s = QUARTER_SINE[k];
+  if (frac)
+    s += ((QUARTER_SINE[k + 1] - s) * frac + 0x80) >> 8;
+  return (phase & 0x8000) ? 32768 - s : 32768 + s;
+}
+
+/*!
+ *  @brief  Sine wave travelling along the range
+ *  @param  phase  Phase of the first channel
+ *  @param  spread Phase step from one channel to the next; 65536 / count
+ * spreads one period over the range
+ *  @param  low    Level at the trough
+ *  @param  high   Level at the crest
+ */
+void PCA9685Effects::wave(uint16_t phase, uint16_t spread, uint16_t low,
+                          uint16_t high) {
+  for (uint16_t i = 0; i < _count; i++, phase += spread)
+    set(i, scale(sine(phase), low, high));
+}
+
+/*!
+ *  @brief  Single lit channel with a fading tail, wrapping around the range
+ *  @param  position Head position in 1/256 channel, so it moves smoothly;
+ * taken modulo the range
+ *  @param  tail     Tail length in 1/256 channel, 0 for a hard edge
+ *  @param  low      Level of unlit channels
+ *  @param  high     Level of the head
+ */
+void PCA9685Effects::chase(uint32_t position, uint16_t tail, uint16_t low,
+                           uint16_t high) {
+  uint32_t length = (uint32_t)_count << 8;
+  if (!length)
+    return;
+  position %= length;
+  for (uint16_t i = 0; i < _count; i++) {
+    // distance the head has travelled past this channel, wrapped
+    uint32_t behind = (position + length - ((uint32_t)i << 8)) % length;
+    uint16_t level = low;
+    if (behind < 256)
+      level = high;
+    else if (behind - 256 < tail)
+      level = scale(0xFFFF - (uint16_t)(((behind - 256) << 16) / tail), low,
+                    high);
+    set(i, level);
+  }
+}
+
+/*!
+ *  @brief  Every channel fading in and out together, with a squared sine so
+ * the glow looks even to the eye
+ *  @param  phase Phase of the breath
+ *  @param  low   Level when fully out
+ *  @param  high  Level when fully in
+ */
+void PCA9685Effects::breathe(uint16_t phase, uint16_t low, uint16_t high) {
+  uint32_t s = sine(phase - 0x4000); // starts from the bottom
+  uint16_t level = scale((s * s) >> 16, low, high);
+  for (uint16_t i = 0; i < _count; i++)
+    set(i, level);
+}
+
+/*!
+ *  @brief  Channels flashing up at random and fading out
+ *  @param  density Chance per channel and frame of a flash, in 1/65536
+ *  @param  fade    Fraction of its level a channel keeps per frame, in 1/256
+ *  @param  high    Level of a flash
+ */
+void PCA9685Effects::twinkle(uint16_t density, uint8_t fade, uint16_t high) {
+  for (uint16_t i = 0; i < _count; i++) {
+    uint16_t n = _first + i, on, off;
+    _fleet->getPWM(n >> 4, n & 15, &on, &off);
+    if (on & 4096) // full on
+      off = 4095;
+    if ((random() >> 16) < density)
+      off = high;
+    else
+      off = ((uint32_t)off * fade) >> 8;
+    set(i, off);
+  }
+}
+
+/*!
+ *  @brief  Linear ramp across the range
+ *  @param  from Level of the first channel
+ *  @param  to   Level of the last channel
+ */
+void PCA9685Effects::gradient(uint16_t from, uint16_t to) {
+  if (_count < 2) {
+    if (_count)
+      set(0, from);
+    return;
+  }
+  int32_t span = (int32_t)to - from;
+  for (uint16_t i = 0; i < _count; i++)
+    set(i, from + (span * i + (span < 0 ? -1 : 1) * (_count - 1) / 2) /
+                      (_count - 1));
+}
+
+void PCA9685Effects::set(uint16_t i, uint16_t level) {
+  uint16_t n = _first + i;
+  if (level >= 4095) // full on, not 4095 of 4096 ticks
+    _fleet->setPWM(n >> 4, n & 15, 4096, 0);
+  else
+    _fleet->setPWM(n >> 4, n & 15, 0, level);
+}
+
+/* xorshift32 */
+uint32_t PCA9685Effects::random() {
+  _rng ^= _rng << 13;
+  _rng ^= _rng >> 17;
+  _rng ^= _rng << 5;
+  return _rng;
+}
+#endif
@@ -0,0 +1,49 @@
+/*!
+ *  @file PCA9685Effects.h
+ *
+ *  Integer effect generators that render into a range of fleet channels.
+ *
+ *  BSD license, all text above must be included in any redistribution
+ */
+#ifndef _PCA9685_EFFECTS_H
+#define _PCA9685_EFFECTS_H
+
+#include "PCA9685Fleet.h"
+
+/*!
+ *  @brief  Wave, chase, breathe, twinkle and gradient effects over a range of
+ * fleet channels.
+ *
+ *  Channels are numbered across the fleet, chip * 16 + channel, so a range
+ *  may span chips. Each call renders one frame with integer arithmetic only
+ *  and stores it with PCA9685Fleet::setPWM(), so channels whose value did
+ *  not change stay clean. Levels run from 0 to 4095 (the OFF count with
+ *  ON = 0), 4095 being sent as full on and anything above taken as 4095;
+ *  a high level below the low one turns an effect upside down. Phases are
+ *  16-bit angles, 65536 being one period; advancing the phase by a fixed
+ *  step per frame sets the speed.
+ */
+class PCA9685Effects {
+public:
+  PCA9685Effects(PCA9685Fleet &fleet, uint16_t first, uint16_t count,
+                 uint32_t seed = 0x9E3779B9);
+  void wave(uint16_t phase, uint16_t spread, uint16_t low = 0,
+            uint16_t high = 4095);
+  void chase(uint32_t position, uint16_t tail, uint16_t low = 0,
+             uint16_t high = 4095);
+  void breathe(uint16_t phase, uint16_t low = 0, uint16_t high = 4095);
+  void twinkle(uint16_t density, uint8_t fade, uint16_t high = 4095);
+  void gradient(uint16_t from, uint16_t to);
+  static uint16_t sine(uint16_t phase);
+
+private:
+  void set(uint16_t i, uint16_t level);
+  uint32_t random();
+
+  PCA9685Fleet *_fleet;
+  uint16_t _first;
+  uint16_t _count;
+  uint32_t _rng;
+};
+
+#endif
@@ -0,0 +1,1032 @@
+/*!
+ *  @file PCA9685Fleet.cpp
+ *
+ *  BSD license, all text above must be included in any redistribution
+ */
+
+#include "mbed_PWMServoDriver.h"
+#if PCA9685_ENABLE_FLEET
+#include "PCA9685Fleet.h"
+#if PCA9685_ENABLE_TELEMETRY
+#include "PCA9685Telemetry.h"
+#endif
+
+#if PCA9685_ENABLE_STATS
+// several threads may count at once, e.g. renderer workers and the flusher
+#define COUNT(counter, n) core_util_atomic_fetch_add_u32(&_stats.counter, n)
+#endif
+
+#if PCA9685_ENABLE_CHANNEL_STATS
+#define BUMP(counter)                                                          \
+  do {                                                                         \
+    if (counter != 0xFFFF)                                                     \
+      counter++;                                                               \
+  } while (0)
+#endif
+
+#if PCA9685_ENABLE_SEQLOCK
+/* Writer side of the per-chip sequence lock. Only the owning thread writes a
+ * chip, so plain load/store is enough and no atomic read-modify-write (which
+ * Cortex-M0+ lacks) is needed. */
+#define WRITE_BEGIN(chip)                                                      \
+  uint32_t seq = _seq[chip].load(std::memory_order_relaxed);                 \
+  _seq[chip].store(seq + 1, std::memory_order_relaxed);                      \
+  std::atomic_thread_fence(std::memory_order_release)
+#define WRITE_END(chip) _seq[chip].store(seq + 2, std::memory_order_release)
+/* Reader side: repeat the copy until no write overlapped it. */
+#define READ_BEGIN(chip)                                                       \
+  uint32_t seq;                                                                \
+  do {                                                                         \
+    seq = _seq[chip].load(std::memory_order_acquire);                          \
+    if (seq & 1)                                                               \
+      continue;
+#define READ_END(chip)                                                         \
+  std::atomic_thread_fence(std::memory_order_acquire);                         \
+  }                                                                            \
+  while ((seq & 1) || seq != _seq[chip].load(std::memory_order_relaxed))
+#else
+#define WRITE_BEGIN(chip)
+#define WRITE_END(chip)
+#define READ_BEGIN(chip) {
+#define READ_END(chip) }
+#endif
+
+/*!
+ *  @brief  Instantiates an empty fleet on one bus
+ *  @param  i2c Bus the chips are on
+ */
+PCA9685Fleet::PCA9685Fleet(I2C &i2c)
+    : _i2c(&i2c), _count(0), _prescale(0), _mode2(MODE2_OUTDRV) {
+#if PCA9685_ENABLE_STATS
+  resetStats();
+#endif
+#if PCA9685_ENABLE_TELEMETRY
+  _telemetry = NULL;
+#endif
+}
+
+/*!
+ *  @brief  Adds a chip; its shadow starts fully off and clean
+ *  @param  addr 7-bit I2C address of the chip
+ *  @return chip index, or -1 if PCA9685_FLEET_MAX_CHIPS are already added
+ */
+int PCA9685Fleet::add(uint8_t addr) {
+  if (_count >= PCA9685_FLEET_MAX_CHIPS)
+    return -1;
+  uint16_t *on = _on + 16 * _count;
+  uint16_t *off = _off + 16 * _count;
+  for (uint8_t num = 0; num < 16; num++) {
+    on[num] = 0;
+    off[num] = 4096; // full OFF, the power-up state
+  }
+  _dirty[_count] = 0;
+  _addr[_count] = addr << 1;
+#if PCA9685_ENABLE_STATS
+  _fail_since[_count] = 0;
+#endif
+#if PCA9685_ENABLE_GROUPS
+  _mode1[_count] = -1;
+  _groups[_count] = 0;
+#endif
+#if PCA9685_ENABLE_QUARANTINE
+  _score[_count] = 0;
+  _probe_at[_count] = 0;
+  _lapsed[_count] = false;
+#endif
+#if PCA9685_ENABLE_SEQLOCK
+  _seq[_count].store(0, std::memory_order_release);
+#endif
+#if PCA9685_ENABLE_WATCHDOG
+  core_util_atomic_store_u32(&_acked_us[_count], us_ticker_read());
+  _failsafed[_count] = 0;
+  setFailsafe(_count, NULL);
+#endif
+  return _count++;
+}
+
+/*!
+ *  @brief  Resets and configures every chip at once: a general call SWRST,
+ * then PRESCALE, MODE2 and MODE1 (awake, auto increment) written once to the
+ * LED All Call address, whatever the number of chips. The shadow goes back to
+ * the power-up state (all off, clean). Note that SWRST resets every PCA9685
+ * on the bus, including chips that were not added to this fleet.
+ *  @param  prescale Value for PCA9685_PRESCALE, e.g. PCA9685Prescale<50>::value
+ *  @param  mode2    Value for PCA9685_MODE2
+ *  @return number of transactions that were not acknowledged
+ */
+int PCA9685Fleet::reset(uint8_t prescale, uint8_t mode2) {
+  const char swrst = PCA9685_SWRST;
+  _prescale = prescale;
+  _mode2 = mode2;
+  int errors = _i2c->write(PCA9685_GENERAL_CALL << 1, &swrst, 1) != 0;
+  wait_us(500);
+  errors += configure(PCA9685_ALLCALL_ADDRESS << 1); // SWRST leaves them asleep
+  wait_us(500); // oscillator start-up
+
+  for (uint8_t chip = 0; chip < _count; chip++) {
+    WRITE_BEGIN(chip);
+    for (uint8_t num = 0; num < 16; num++) {
+      _on[16 * chip + num] = 0;
+      _off[16 * chip + num] = 4096;
+    }
+    WRITE_END(chip);
+    _dirty[chip] = 0;
+#if PCA9685_ENABLE_GROUPS
+    _mode1[chip] = MODE1_AI | MODE1_ALLCAL;
+    _groups[chip] = 0;
+#endif
+  }
+  return errors;
+}
+
+/*!
+ *  @brief  Writes the fleet configuration from reset() to sleeping chips and
+ * wakes them: PRESCALE, MODE2, MODE1 (awake, auto increment) and, with
+ * PCA9685_ENABLE_GROUPS, the three subaddresses
+ *  @param  addr 8-bit address, of one chip or the LED All Call address
+ *  @return 1 if a step was not acknowledged, which skips the rest, else 0
+ */
+int PCA9685Fleet::configure(uint8_t addr) {
+  static const uint8_t script[] = {
+      PCA9685_WRITE_ARG(PCA9685_PRESCALE, 0),
+      PCA9685_WRITE_ARG(PCA9685_MODE2, 1),
+      PCA9685_WRITE(PCA9685_MODE1, MODE1_AI | MODE1_ALLCAL),
+#if PCA9685_ENABLE_GROUPS
+      // MODE1 now has auto increment, so the subaddresses go in one burst
+      PCA9685_WRITE(PCA9685_SUBADR1, PCA9685_SUBADR1_ADDRESS << 1,
+                    PCA9685_SUBADR2_ADDRESS << 1, PCA9685_SUBADR3_ADDRESS << 1),
+#endif
+      PCA9685_END};
+  const uint8_t args[] = {_prescale, _mode2};
+  return PCA9685Script(script).run(*_i2c, addr, args) != 0;
+}
+
+/*!
+ *  @brief  Runs a register script on every chip of the fleet
+ *  @param  script    Script to run
+ *  @param  args      Values for its PCA9685_WRITE_ARG() steps
+ *  @param  broadcast Run it once on the LED All Call address instead of once
+ * per chip; the script must then not read
+ *  @return number of chips, or broadcasts, whose script failed
+ */
+int PCA9685Fleet::run(const PCA9685Script &script, const uint8_t *args,
+                      bool broadcast) {
+  if (broadcast)
+    return script.run(*_i2c, PCA9685_ALLCALL_ADDRESS << 1, args) != 0;
+  int failed = 0;
+  for (uint8_t chip = 0; chip < _count; chip++)
+    failed += script.run(*_i2c, _addr[chip], args) != 0;
+  return failed;
+}
+
+/*!
+ *  @brief  Sets one channel in the shadow; it is only marked dirty when the
+ * value changes. Channels of chips that were not added are ignored.
+ *  @param  chip Index returned by add()
+ *  @param  num  One of the PWM output pins, from 0 to 15
+ *  @param  on   At what point in the 4095-part cycle to turn the output ON
+ *  @param  off  At what point in the 4095-part cycle to turn the output OFF
+ */
+void PCA9685Fleet::setPWM(uint8_t chip, uint8_t num, uint16_t on,
+                          uint16_t off) {
+  if (chip >= _count || num > 15)
+    return;
+  unsigned i = 16 * chip + num;
+#if PCA9685_ENABLE_WATCHDOG
+  // the first change after a trip sends the whole frame over the failsafe
+  if (_failsafed[chip] && core_util_atomic_exchange_u8(&_failsafed[chip], 0))
+    core_util_atomic_fetch_or_u16(&_dirty[chip], 0xFFFF);
+#endif
+#if PCA9685_ENABLE_STATS
+  COUNT(requested, 1);
+#endif
+#if PCA9685_ENABLE_CHANNEL_STATS
+  BUMP(_channel[i].requested);
+#endif
+  if (_on[i] == on && _off[i] == off) {
+#if PCA9685_ENABLE_STATS
+    COUNT(suppressed, 1);
+#endif
+#if PCA9685_ENABLE_CHANNEL_STATS
+    BUMP(_channel[i].suppressed);
+#endif
+#if PCA9685_ENABLE_WATCHDOG
+    // the chip already holds this value, so holding still counts as live
+    if (!(_dirty[chip] & (1 << num)))
+      core_util_atomic_store_u32(&_acked_us[chip], us_ticker_read());
+#endif
+    return;
+  }
+  if (_dirty[chip] & (1 << num)) {
+#if PCA9685_ENABLE_STATS
+    COUNT(coalesced, 1);
+#endif
+#if PCA9685_ENABLE_CHANNEL_STATS
+    BUMP(_channel[i].coalesced);
+#endif
+  }
+  WRITE_BEGIN(chip);
+  _on[i] = on;
+  _off[i] = off;
+  WRITE_END(chip);
+  core_util_atomic_fetch_or_u16(&_dirty[chip], 1 << num);
+}
+
+/*!
+ *  @brief  Writes to one chip, applying any injected fault
+ *  @param  chip   Index returned by add()
+ *  @param  data   Register address followed by data
+ *  @param  length Bytes to send
+ *  @param  repeated Keep the bus for a repeated start
+ *  @return 0 on ACK, non-zero on NACK
+ */
+int PCA9685Fleet::write(uint8_t chip, const char *data, int length,
+                        bool repeated) {
+#if PCA9685_ENABLE_FAULT_INJECTION
+  switch (_fault ? _fault(chip) : PCA9685_FAULT_NONE) {
+  case PCA9685_FAULT_ADDR_NACK:
+    return 1;
+  case PCA9685_FAULT_DATA_NACK:
+    _i2c->write(_addr[chip], data, (length + 1) / 2);
+    return 1;
+  case PCA9685_FAULT_HANG:
+    wait_us(PCA9685_FAULT_HANG_US);
+    return 1;
+  case PCA9685_FAULT_STRETCH:
+    wait_us(PCA9685_FAULT_STRETCH_US);
+    break;
+  default:
+    break;
+  }
+#endif
+  return _i2c->write(_addr[chip], data, length, repeated);
+}
+
+#if PCA9685_ENABLE_STATS
+/*!
+ *  @brief  Counters since construction or the last resetStats(), each read
+ * atomically
+ *  @return fleet-wide counters
+ */
+PCA9685FleetStats PCA9685Fleet::stats() const {
+  PCA9685FleetStats copy;
+  const uint32_t *from = (const uint32_t *)&_stats;
+  uint32_t *to = (uint32_t *)&copy;
+  for (unsigned i = 0; i < sizeof(copy) / sizeof(uint32_t); i++)
+    to[i] = core_util_atomic_load_u32(from + i);
+  return copy;
+}
+
+/*!
+ *  @brief  Zeroes the fleet counters, and the per-channel ones with
+ * PCA9685_ENABLE_CHANNEL_STATS
+ */
+void PCA9685Fleet::resetStats() {
+  uint32_t *counter = (uint32_t *)&_stats;
+  for (unsigned i = 0; i < sizeof(_stats) / sizeof(uint32_t); i++)
+    core_util_atomic_store_u32(counter + i, 0);
+#if PCA9685_ENABLE_CHANNEL_STATS
+  memset(_channel, 0, sizeof(_channel));
+  memset(_bytes, 0, sizeof(_bytes));
+#endif
+}
+#endif
+
+#if PCA9685_ENABLE_CHANNEL_STATS
+/*!
+ *  @brief  Copies the counters of a chip's 16 channels, e.g. to dump one
+ * row of a traffic heatmap
+ *  @param  chip  Index returned by add()
+ *  @param  stats Receives 16 entries
+ */
+void PCA9685Fleet::channelStats(uint8_t chip, PCA9685ChannelStats *stats) {
+  memcpy(stats, _channel + 16 * chip, 16 * sizeof(PCA9685ChannelStats));
+}
+#endif
+
+#if PCA9685_ENABLE_TELEMETRY
+/*!
+ *  @brief  Records every channel value once the chip acknowledged it, with
+ * the chip's 7-bit address
+ *  @param  telemetry Recorder to append to, or NULL to stop recording
+ */
+void PCA9685Fleet::setTelemetry(PCA9685Telemetry *telemetry) {
+  _telemetry = telemetry;
+}
+#endif
+
+/* Counts channels that were sent and acknowledged and records their values;
+ * on[] and off[] hold the chip's 16 channels as they were sent. */
+void PCA9685Fleet::countSent(uint8_t chip, uint16_t sent, const uint16_t *on,
+                             const uint16_t *off) {
+#if PCA9685_ENABLE_STATS
+  COUNT(transmitted, __builtin_popcount(sent));
+#endif
+#if PCA9685_ENABLE_WATCHDOG
+  if (sent)
+    core_util_atomic_store_u32(&_acked_us[chip], us_ticker_read());
+#endif
+  for (uint8_t num = 0; sent >> num; num++) {
+    if (!(sent & (1 << num)))
+      continue;
+#if PCA9685_ENABLE_CHANNEL_STATS
+    BUMP(_channel[16 * chip + num].transmitted);
+#endif
+#if PCA9685_ENABLE_TELEMETRY
+    if (_telemetry)
+      _telemetry->record(address(chip), num, on[num], off[num]);
+#endif
+  }
+#if !PCA9685_ENABLE_CHANNEL_STATS && !PCA9685_ENABLE_TELEMETRY &&           \
+    !PCA9685_ENABLE_WATCHDOG
+  (void)chip;
+#endif
+#if !PCA9685_ENABLE_TELEMETRY
+  (void)on;
+  (void)off;
+#endif
+}
+
+/*!
+ *  @brief  Reads one channel from the shadow, without touching the bus; safe
+ * to call from any thread. Channels of chips that were not added read as
+ * full off.
+ *  @param  chip Index returned by add()
+ *  @param  num  One of the PWM output pins, from 0 to 15
+ *  @param  on   Receives the ON tick
+ *  @param  off  Receives the OFF tick
+ */
+void PCA9685Fleet::getPWM(uint8_t chip, uint8_t num, uint16_t *on,
+                          uint16_t *off) {
+  if (chip >= _count || num > 15) {
+    *on = 0;
+    *off = 4096;
+    return;
+  }
+  unsigned i = 16 * chip + num;
+  READ_BEGIN(chip);
+  *on = _on[i];
+  *off = _off[i];
+  READ_END(chip);
+}
+
+/*!
+ *  @brief  Copies a consistent view of all 16 channels of a chip; safe to
+ * call from any thread. A chip that was not added reads as full off.
+ *  @param  chip Index returned by add()
+ *  @param  on   Receives 16 ON ticks
+ *  @param  off  Receives 16 OFF ticks
+ */
+void PCA9685Fleet::snapshot(uint8_t chip, uint16_t *on, uint16_t *off) {
+  if (chip >= _count) {
+    for (uint8_t num = 0; num < 16; num++) {
+      on[num] = 0;
+      off[num] = 4096;
+    }
+    return;
+  }
+  READ_BEGIN(chip);
+  memcpy(on, _on + 16 * chip, 16 * sizeof(uint16_t));
+  memcpy(off, _off + 16 * chip, 16 * sizeof(uint16_t));
+  READ_END(chip);
+}
+
+/*!
+ *  @brief  Finds the next burst in a dirty mask. Runs of dirty channels are
+ * sent as auto-increment bursts; a gap of clean channels is sent along when
+ * that is cheaper than starting another transaction.
+ *  @param  dirty Channels to send
+ *  @param  num   Channel to start searching from, advanced past the burst
+ *  @param  first Receives the first channel of the burst
+ *  @param  last  Receives the last channel of the burst
+ *  @return false when no dirty channel is left
+ */
+static bool nextRun(uint16_t dirty, uint8_t *num, uint8_t *first,
+                    uint8_t *last) {
+  uint8_t n = *num;
+  if (n >= 16 || !(dirty >> n))
+    return false;
+  while (!(dirty & (1 << n)))
+    n++;
+  *first = *last = n;
+  for (n++; n < 16; n++) {
+    if (dirty & (1 << n))
+      *last = n;
+    else if (4 * (n - *last) > PCA9685_BURST_OVERHEAD)
+      break;
+  }
+  *num = *last + 1;
+  return true;
+}
+
+/* Packs channels first..last into an auto-increment burst; returns its
+ * length. unpack() reads them back. */
+static int pack(char *cmd, const uint16_t *on, const uint16_t *off,
+                uint8_t first, uint8_t last) {
+  char *p = cmd;
+  *p++ = PCA9685_LED0_ON_L + 4 * first;
+  for (uint8_t c = first; c <= last; c++) {
+    *p++ = on[c];
+    *p++ = on[c] >> 8;
+    *p++ = off[c];
+    *p++ = off[c] >> 8;
+  }
+  return p - cmd;
+}
+
+#if PCA9685_ENABLE_TELEMETRY
+static void unpack(const char *cmd, uint16_t *on, uint16_t *off,
+                   uint8_t first, uint8_t last) {
+  const uint8_t *p = (const uint8_t *)cmd + 1;
+  for (uint8_t c = first; c <= last; c++, p += 4) {
+    on[c] = p[0] | p[1] << 8;
+    off[c] = p[2] | p[3] << 8;
+  }
+}
+#endif
+
+#if PCA9685_ENABLE_WATCHDOG
+/*!
+ *  @brief  Precomputes the frame sendFailsafe() sends to a chip
+ *  @param  chip Index returned by add()
+ *  @param  off  OFF tick for each of the 16 pins (ON tick 0), a value of 4096
+ * meaning fully off; NULL selects all pins fully off via ALL_LED
+ */
+void PCA9685Fleet::setFailsafe(uint8_t chip, const uint16_t *off) {
+  char *frame = _failsafe[chip];
+  if (!off) {
+    static const char all_off[] = {(char)PCA9685_ALLLED_ON_L, 0, 0, 0, 0x10};
+    memcpy(frame, all_off, sizeof(all_off));
+    _failsafe_len[chip] = sizeof(all_off);
+    return;
+  }
+  uint16_t on[16] = {0};
+  _failsafe_len[chip] = pack(frame, on, off, 0, 15);
+}
+
+/*!
+ *  @brief  Sends a chip's failsafe frame in a single I2C write. The shadow
+ * is left alone, and flushes do not undo the failsafe; the next setPWM() on
+ * the chip marks its whole frame dirty, so a controller that comes back
+ * restores every channel, even those it sets to their pre-trip values.
+ *  @param  chip Index returned by add()
+ *  @return 0 on ACK, 1 on NACK
+ */
+int PCA9685Fleet::sendFailsafe(uint8_t chip) {
+  core_util_atomic_store_u8(&_failsafed[chip], 1);
+  return write(chip, _failsafe[chip], _failsafe_len[chip]) != 0;
+}
+#endif
+
+#if PCA9685_ENABLE_GROUPS
+/* Subaddress groups a MODE1 value joins, bit g for SUBADR g+1. */
+static uint8_t groupsOf(uint8_t mode1) {
+  return (mode1 & MODE1_SUB1 ? 1 : 0) | (mode1 & MODE1_SUB2 ? 2 : 0) |
+         (mode1 & MODE1_SUB3 ? 4 : 0);
+}
+
+/* Bus cost of sending a dirty mask, in data-byte equivalents. */
+static unsigned burstCost(uint16_t dirty) {
+  unsigned cost = 0;
+  uint8_t num = 0, first, last;
+  while (nextRun(dirty, &num, &first, &last))
+    cost += PCA9685_BURST_OVERHEAD + 2 + 4 * (last - first + 1);
+  return cost;
+}
+#endif
+
+/*!
+ *  @brief  Flushes every chip with dirty channels. With
+ * PCA9685_ENABLE_GROUPS, chips holding identical frames are first sent one
+ * burst through a subaddress group when that saves bus time.
+ *  @return number of transactions that were not acknowledged
+ */
+int PCA9685Fleet::flush() {
+  int errors = 0;
+#if PCA9685_ENABLE_GROUPS
+  for (uint8_t chip = 0; chip + 1 < _count; chip++) {
+    if (_dirty[chip])
+      errors += flushGroup(chip);
+  }
+#endif
+  for (uint8_t chip = 0; chip < _count; chip++) {
+    if (_dirty[chip])
+      errors += flush(chip);
+  }
+  return errors;
+}
+
+/*!
+ *  @brief  Sends one chip's dirty channels as bursts. Channels of a NACKed
+ * burst stay dirty.
+ *  @param  chip Index returned by add()
+ *  @param  mask Channels to send, e.g. those due for refresh; other dirty
+ * channels only ride along when they fall inside one of the bursts anyway
+ *  @return number of transactions that were not acknowledged
+ */
+int PCA9685Fleet::flush(uint8_t chip, uint16_t mask) {
+#if PCA9685_ENABLE_QUARANTINE
+  if (_probe_at[chip]) {
+    if ((int32_t)(us_ticker_read() - _probe_at[chip]) < 0)
+      return 0; // shadow keeps the changes until the chip is back
+    if (probe(chip))
+      return 1;
+  } else if (_lapsed[chip] && restore(chip)) {
+    noteHealth(chip, false);
+    return 1;
+  }
+#endif
+  int errors = 0;
+  uint16_t on[16], off[16];
+  uint16_t dirty = core_util_atomic_fetch_and_u16(&_dirty[chip], ~mask) & mask;
+  if (mask != 0xFFFF) {
+    uint16_t span = 0;
+    uint8_t num = 0, first, last;
+    while (nextRun(dirty, &num, &first, &last))
+      span |= (uint16_t)((0xFFFF << first) & (0xFFFF >> (15 - last)));
+    dirty |= core_util_atomic_fetch_and_u16(&_dirty[chip], ~span) & span;
+  }
+  snapshot(chip, on, off);
+  uint16_t acked = send(chip, 0, on, off, dirty, &errors);
+  settle(chip, dirty, acked, errors, on, off);
+  return errors;
+}
+
+/*!
+ *  @brief  Flushes every chip with dirty channels like flush(), but plans
+ * the bursts of all chips into a batch and submits it under one bus lock. A
+ * batch too small for the whole frame is submitted whenever it fills up.
+ * Quarantined chips and, with PCA9685_ENABLE_FAULT_INJECTION, injected
+ * faults still go through flush(chip).
+ *  @param  batch Batch to plan into; it is cleared first
+ *  @return number of transactions that were not acknowledged
+ */
+int PCA9685Fleet::flush(PCA9685Batch &batch) {
+  int errors = 0;
+  uint16_t claimed[PCA9685_FLEET_MAX_CHIPS];
+  uint16_t on[16], off[16];
+  uint8_t first = 0; // first chip planned into the batch
+
+#if PCA9685_ENABLE_GROUPS
+  for (uint8_t chip = 0; chip + 1 < _count; chip++) {
+    if (_dirty[chip])
+      errors += flushGroup(chip);
+  }
+#endif
+  batch.clear();
+  for (uint8_t chip = 0; chip < _count; chip++) {
+    claimed[chip] = 0;
+    bool direct = false;
+#if PCA9685_ENABLE_QUARANTINE
+    direct = direct || held(chip);
+#endif
+#if PCA9685_ENABLE_FAULT_INJECTION
+    direct = direct || _fault;
+#endif
+    if (!_dirty[chip] || direct) {
+      if (_dirty[chip])
+        errors += flush(chip);
+      continue;
+    }
+    uint16_t dirty = core_util_atomic_exchange_u16(&_dirty[chip], 0);
+    snapshot(chip, on, off);
+    uint8_t segments = 0, num = 0, lo, hi;
+    uint16_t bytes = 0;
+    while (nextRun(dirty, &num, &lo, &hi)) {
+      segments++;
+      bytes += 1 + 4 * (hi - lo + 1);
+    }
+    if (!batch.fits(segments, bytes)) {
+      errors += submit(batch, first, chip, claimed);
+      batch.clear();
+      first = chip;
+    }
+    if (!batch.fits(segments, bytes)) { // too big for any batch: send directly
+      int failed = 0;
+      uint16_t acked = send(chip, 0, on, off, dirty, &failed);
+      settle(chip, dirty, acked, failed, on, off);
+      errors += failed;
+      first = chip + 1;
+      continue;
+    }
+    claimed[chip] = dirty;
+    num = 0;
+    while (nextRun(dirty, &num, &lo, &hi))
+      pack(batch.write(_addr[chip], 1 + 4 * (hi - lo + 1)), on, off, lo, hi);
+  }
+  return errors + submit(batch, first, _count, claimed);
+}
+
+/* Submits a batch planned for chips [first, end) and books each chip's
+ * outcome, walking the segments in the order they were planned. */
+int PCA9685Fleet::submit(PCA9685Batch &batch, uint8_t first, uint8_t end,
+                         const uint16_t *claimed) {
+  int total = batch.submit(*_i2c);
+  uint8_t i = 0;
+  for (uint8_t chip = first; chip < end; chip++) {
+    if (!claimed[chip])
+      continue;
+    int errors = 0;
+    uint16_t acked = 0, on[16], off[16];
+    uint8_t num = 0, lo, hi;
+    while (nextRun(claimed[chip], &num, &lo, &hi)) {
+      const PCA9685Segment &seg = batch.segment(i++);
+#if PCA9685_ENABLE_CHANNEL_STATS
+      _bytes[chip] += 1 + seg.length;
+#endif
+      if (seg.acked) {
+        acked |= (uint16_t)((0xFFFF << lo) & (0xFFFF >> (15 - hi)));
+#if PCA9685_ENABLE_TELEMETRY
+        if (_telemetry)
+          unpack(seg.data, on, off, lo, hi);
+#endif
+      } else {
+        errors++;
+#if PCA9685_ENABLE_STATS
+        COUNT(failed, 1);
+#endif
+      }
+    }
+    settle(chip, claimed[chip], acked, errors, on, off);
+  }
+  return total;
+}
+
+/* Books the outcome of sending a chip's claimed dirty channels: counts and
+ * records what was acknowledged, marks the rest dirty again and tracks the
+ * chip's failures and recovery. on[] and off[] are the values sent. */
+void PCA9685Fleet::settle(uint8_t chip, uint16_t dirty, uint16_t acked,
+                          int errors, const uint16_t *on,
+                          const uint16_t *off) {
+  countSent(chip, dirty & acked, on, off);
+  if (dirty & ~acked)
+    core_util_atomic_fetch_or_u16(&_dirty[chip], dirty & ~acked);
+#if PCA9685_ENABLE_STATS
+  if (errors) {
+    COUNT(frames_lost, 1);
+    if (!_fail_since[chip])
+      _fail_since[chip] = us_ticker_read() | 1; // 0 means healthy
+  } else if (_fail_since[chip]) {
+    COUNT(recoveries, 1);
+    uint32_t took = us_ticker_read() - _fail_since[chip];
+    core_util_atomic_store_u32(&_stats.recovery_last_us, took);
+    uint32_t worst = core_util_atomic_load_u32(&_stats.recovery_max_us);
+    while (took > worst &&
+           !core_util_atomic_cas_u32(&_stats.recovery_max_us, &worst, took)) {
+    }
+    _fail_since[chip] = 0;
+  }
+#endif
+#if PCA9685_ENABLE_QUARANTINE
+  noteHealth(chip, !errors);
+#endif
+#if !PCA9685_ENABLE_STATS && !PCA9685_ENABLE_QUARANTINE
+  (void)errors;
+#endif
+}
+
+#if PCA9685_ENABLE_QUARANTINE
+/* Updates a chip's error score and quarantines it past the threshold. */
+void PCA9685Fleet::noteHealth(uint8_t chip, bool ok) {
+  if (ok) { // decays by a quarter, and at least 1 so it reaches 0
+    if (_score[chip])
+      _score[chip] -= _score[chip] > 4 ? _score[chip] >> 2 : 1;
+    return;
+  }
+  _lapsed[chip] = true;
+  _score[chip] = min(255, _score[chip] + 48);
+  if (_score[chip] >= PCA9685_QUARANTINE_SCORE && !_probe_at[chip]) {
+    _probe_at[chip] = (us_ticker_read() + PCA9685_REPROBE_US) | 1;
+#if PCA9685_ENABLE_STATS
+    COUNT(quarantines, 1);
+#endif
+  }
+}
+
+/*!
+ *  @brief  Reads MODE1 of a chip that NACKed, which may have lost power
+ * meanwhile, and reconfigures it if it came back reset (asleep) and reset()
+ * told us the configuration. A reconfigured chip has its whole frame marked
+ * dirty, since its outputs are all off.
+ *  @param  chip Index returned by add()
+ *  @return 0 if the chip answered and is configured, 1 otherwise
+ */
+int PCA9685Fleet::restore(uint8_t chip) {
+  char mode1 = PCA9685_MODE1;
+  if (write(chip, &mode1, 1, true) || _i2c->read(_addr[chip], &mode1, 1))
+    return 1;
+#if PCA9685_ENABLE_GROUPS
+  _mode1[chip] = (uint8_t)mode1 & ~MODE1_RESTART;
+  _groups[chip] = groupsOf(_mode1[chip]);
+#endif
+  if ((mode1 & MODE1_SLEEP) && _prescale) {
+    if (configure(_addr[chip]))
+      return 1;
+    wait_us(500); // oscillator start-up
+#if PCA9685_ENABLE_GROUPS
+    _mode1[chip] = MODE1_AI | MODE1_ALLCAL;
+    _groups[chip] = 0;
+#endif
+    core_util_atomic_fetch_or_u16(&_dirty[chip], 0xFFFF);
+  }
+  _lapsed[chip] = false;
+  return 0;
+}
+
+/*!
+ *  @brief  Checks whether a quarantined chip answers again with restore().
+ * If it does, its whole frame is marked dirty, so the flush that follows
+ * restores it in one burst.
+ *  @param  chip Index returned by add()
+ *  @return 0 if the chip is back, 1 if it stays quarantined
+ */
+int PCA9685Fleet::probe(uint8_t chip) {
+  if (restore(chip)) {
+    _probe_at[chip] = (us_ticker_read() + PCA9685_REPROBE_US) | 1;
+    return 1;
+  }
+  _probe_at[chip] = 0;
+  _score[chip] = 0;
+  core_util_atomic_fetch_or_u16(&_dirty[chip], 0xFFFF);
+#if PCA9685_ENABLE_STATS
+  COUNT(reintegrations, 1);
+#endif
+  return 0;
+}
+#endif
+
+/*!
+ *  @brief  Sends channel values as bursts
+ *  @param  chip   Index returned by add(), for fault injection and its address
+ *  @param  addr   8-bit address to send to, 0 for the chip's own
+ *  @param  on     16 ON ticks
+ *  @param  off    16 OFF ticks
+ *  @param  dirty  Channels to send
+ *  @param  errors Incremented for every burst that was not acknowledged
+ *  @return channels that were acknowledged
+ */
+uint16_t PCA9685Fleet::send(uint8_t chip, uint8_t addr, const uint16_t *on,
+                            const uint16_t *off, uint16_t dirty, int *errors) {
+  char cmd[1 + 4 * 16];
+  uint16_t acked = 0;
+  uint8_t num = 0, first, last;
+
+  while (nextRun(dirty, &num, &first, &last)) {
+    int length = pack(cmd, on, off, first, last);
+    int nack = addr ? _i2c->write(addr, cmd, length)
+                    : write(chip, cmd, length);
+#if PCA9685_ENABLE_CHANNEL_STATS
+    _bytes[chip] += 1 + length;
+#endif
+    if (nack) {
+      (*errors)++;
+#if PCA9685_ENABLE_STATS
+      COUNT(failed, 1);
+#endif
+    } else {
+      acked |= (uint16_t)((0xFFFF << first) & (0xFFFF >> (15 - last)));
+    }
+  }
+  return acked;
+}
+
+#if PCA9685_ENABLE_GROUPS
+/*!
+ *  @brief  Sends the frame of a chip once to every later chip holding the
+ * identical frame, through one of the three subaddress groups. The group
+ * whose membership is closest to that set of chips is chosen, and it is only
+ * used when the membership changes (a MODE1 write per chip joining or
+ * leaving) plus one burst cost less than a burst per chip. Memberships are
+ * kept, so a pattern that repeats pays for them once.
+ *  @param  leader First chip of the candidate set
+ *  @return number of transactions that were not acknowledged
+ */
+int PCA9685Fleet::flushGroup(uint8_t leader) {
+  const uint16_t *on = _on + 16 * leader;
+  const uint16_t *off = _off + 16 * leader;
+  uint16_t dirty = _dirty[leader];
+  uint8_t members[PCA9685_FLEET_MAX_CHIPS];
+  uint8_t count = 0;
+
+  members[count++] = leader;
+#if PCA9685_ENABLE_QUARANTINE
+  if (held(leader))
+    return 0;
+#endif
+  for (uint8_t chip = leader + 1; chip < _count; chip++) {
+#if PCA9685_ENABLE_QUARANTINE
+    if (held(chip))
+      continue;
+#endif
+    if (_dirty[chip] &&
+        !memcmp(on, _on + 16 * chip, 16 * sizeof(uint16_t)) &&
+        !memcmp(off, _off + 16 * chip, 16 * sizeof(uint16_t))) {
+      members[count++] = chip;
+      dirty |= _dirty[chip];
+    }
+  }
+  if (count < 2)
+    return 0;
+
+  // pick the group needing the fewest membership changes
+  uint8_t group = 0;
+  unsigned changes = ~0u;
+  for (uint8_t g = 0; g < 3; g++) {
+    unsigned c = 0;
+    bool usable = true;
+    for (uint8_t chip = 0, m = 0; chip < _count; chip++) {
+      bool wanted = m < count && members[m] == chip;
+      m += wanted;
+#if PCA9685_ENABLE_QUARANTINE
+      // never a member, and not worth a write; a group it may still be in
+      // would hand it the leader's frame behind its shadow
+      if (held(chip)) {
+        usable = usable && !(_groups[chip] & (1 << g));
+        continue;
+      }
+#endif
+      c += wanted != (bool)(_groups[chip] & (1 << g));
+    }
+    if (usable && c < changes) {
+      changes = c;
+      group = g;
+    }
+  }
+  if (changes == ~0u)
+    return 0;
+  unsigned burst = burstCost(dirty);
+  if (changes * (PCA9685_BURST_OVERHEAD + 3) + burst >= count * burst)
+    return 0;
+
+  int errors = 0;
+  static const uint8_t sub_bit[3] = {MODE1_SUB1, MODE1_SUB2, MODE1_SUB3};
+  for (uint8_t chip = 0, m = 0; chip < _count; chip++) {
+    bool wanted = m < count && members[m] == chip;
+    m += wanted;
+#if PCA9685_ENABLE_QUARANTINE
+    if (held(chip)) // in no group used, restore() refreshes its membership
+      continue;
+#endif
+    char cmd[2] = {PCA9685_MODE1, 0};
+    if (_mode1[chip] < 0) { // not known yet, or invalidated
+      if (write(chip, cmd, 1, true) || _i2c->read(_addr[chip], cmd + 1, 1))
+        return errors + 1;
+      _mode1[chip] = (uint8_t)cmd[1] & ~MODE1_RESTART;
+      _groups[chip] = groupsOf(_mode1[chip]);
+    }
+    if (wanted == (bool)(_groups[chip] & (1 << group)))
+      continue;
+    cmd[1] = wanted ? _mode1[chip] | sub_bit[group]
+                    : _mode1[chip] & ~sub_bit[group];
+    if (write(chip, cmd, 2))
+      return errors + 1; // membership unknown, send individually
+    _mode1[chip] = (uint8_t)cmd[1];
+    _groups[chip] = groupsOf(cmd[1]);
+  }
+
+  static const uint8_t sub_addr[3] = {PCA9685_SUBADR1_ADDRESS,
+                                      PCA9685_SUBADR2_ADDRESS,
+                                      PCA9685_SUBADR3_ADDRESS};
+  uint16_t claimed[PCA9685_FLEET_MAX_CHIPS];
+  uint16_t sent_on[16], sent_off[16], now_on[16], now_off[16];
+  for (uint8_t m = 0; m < count; m++)
+    claimed[m] = core_util_atomic_exchange_u16(&_dirty[members[m]], 0);
+  snapshot(leader, sent_on, sent_off);
+  uint16_t acked =
+      send(leader, sub_addr[group] << 1, sent_on, sent_off, dirty, &errors);
+  for (uint8_t m = 0; m < count; m++) {
+    uint16_t retry = claimed[m] & ~acked;
+    // a member changed since it was compared got the leader's values
+    snapshot(members[m], now_on, now_off);
+    if (memcmp(now_on, sent_on, sizeof(now_on)) ||
+        memcmp(now_off, sent_off, sizeof(now_off)))
+      retry = claimed[m] | dirty;
+    countSent(members[m], claimed[m] & ~retry, sent_on, sent_off);
+    if (retry)
+      core_util_atomic_fetch_or_u16(&_dirty[members[m]], retry);
+  }
+  return errors;
+}
+#endif
+
+/*!
+ *  @brief  Reads a chip's LED registers back and compares them with the
+ * shadow, to detect state divergence
+ *  @param  chip Index returned by add()
+ *  @return bit n set if clean channel n differs from the shadow, or -1 if
+ * the chip did not acknowledge
+ */
+int PCA9685Fleet::verify(uint8_t chip) {
+  char reg = PCA9685_LED0_ON_L;
+  uint8_t regs[4 * 16];
+  if (write(chip, &reg, 1, true) ||
+      _i2c->read(_addr[chip], (char *)regs, sizeof(regs)))
+    return -1;
+  uint16_t on[16], off[16];
+  snapshot(chip, on, off);
+  int diverged = 0;
+  for (uint8_t num = 0; num < 16; num++) {
+    const uint8_t *led = regs + 4 * num;
+    if ((led[0] | led[1] << 8) != on[num] || (led[2] | led[3] << 8) != off[num])
+      diverged |= 1 << num;
+  }
+  return diverged & ~_dirty[chip];
+}
+
+#if PCA9685_ENABLE_SOFT_START
+/*!
+ *  @brief  Brings every chip online without an inrush spike: forces all
+ * outputs off, wakes the chips, then enables the shadow's lit channels in
+ * steps whose summed rated current stays under a limit. Channels are packed
+ * heaviest first (first-fit decreasing), so the rig comes up in close to the
+ * fewest steps; a channel rated above the limit gets a step of its own.
+ *  @param  rated_ma Rated current per fleet channel (chip * 16 + pin), or
+ * NULL to count every channel as 1
+ *  @param  limit_ma Largest total rated current to enable in one step
+ *  @param  step     Time for the inrush of one step to settle
+ *  @return number of transactions that were not acknowledged
+ */
+int PCA9685Fleet::softStart(const uint16_t *rated_ma, uint32_t limit_ma,
+                            chrono::milliseconds step) {
+  static const char all_off[] = {(char)PCA9685_ALLLED_ON_L, 0, 0, 0, 0x10};
+  uint16_t order[PCA9685_FLEET_CHANNELS];
+  unsigned count = 0;
+  int errors = 0;
+
+  for (uint8_t chip = 0; chip < _count; chip++) {
+    errors += write(chip, all_off, sizeof(all_off)) != 0;
+    errors += wake(chip);
+    _dirty[chip] = 0;
+  }
+  // lit channels, sorted by descending rated current
+  for (unsigned i = 0; i < 16u * _count; i++) {
+    if ((_off[i] & 0x1000) && !(_on[i] & 0x1000))
+      continue; // stays off
+    uint16_t ma = rated_ma ? rated_ma[i] : 1;
+    unsigned j = count++;
+    for (; j > 0 && (rated_ma ? rated_ma[order[j - 1]] : 1) < ma; j--)
+      order[j] = order[j - 1];
+    order[j] = i;
+  }
+  while (count) {
+    uint32_t load = 0;
+    unsigned kept = 0;
+    for (unsigned k = 0; k < count; k++) {
+      unsigned i = order[k];
+      uint16_t ma = rated_ma ? rated_ma[i] : 1;
+      if (load == 0 || load + ma <= limit_ma) {
+        load += ma;
+        core_util_atomic_fetch_or_u16(&_dirty[i / 16], 1 << (i % 16));
+      } else {
+        order[kept++] = i;
+      }
+    }
+    count = kept;
+    errors += flush();
+    if (count)
+      ThisThread::sleep_for(step);
+  }
+  return errors;
+}
+#endif
+
+/*!
+ *  @brief  Forgets what the fleet cached about a chip's MODE1, so it is read
+ * back before the chip's subaddress groups change again. Call it after
+ * writing MODE1 of the chip outside the fleet.
+ *  @param  chip Index returned by add()
+ */
+void PCA9685Fleet::invalidate(uint8_t chip) {
+#if PCA9685_ENABLE_GROUPS
+  _mode1[chip] = -1;
+#else
+  (void)chip;
+#endif
+}
+
+/*!
+ *  @brief  Clears MODE1_SLEEP on one chip and restarts its PWM channels
+ *  @param  chip Index returned by add()
+ *  @return number of transactions that were not acknowledged
+ */
+int PCA9685Fleet::wake(uint8_t chip) {
+  char cmd[2] = {PCA9685_MODE1, 0};
+  if (write(chip, cmd, 1, true) || _i2c->read(_addr[chip], cmd + 1, 1))
+    return 1;
+  cmd[1] &= ~MODE1_RESTART;
+#if PCA9685_ENABLE_GROUPS
+  _mode1[chip] = (uint8_t)cmd[1] & ~MODE1_SLEEP; // what it is once awake
+  _groups[chip] = groupsOf(cmd[1]);
+#endif
+  if (!(cmd[1] & MODE1_SLEEP))
+    return 0;
+  cmd[1] &= ~MODE1_SLEEP;
+  if (write(chip, cmd, 2)) {
+    invalidate(chip);
+    return 1;
+  }
+  wait_us(500); // oscillator start-up
+  cmd[1] |= MODE1_RESTART;
+  return write(chip, cmd, 2) != 0;
+}
+#endif
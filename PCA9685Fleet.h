@@ -0,0 +1,276 @@
+/*!
+ *  @file PCA9685Fleet.h
+ *
+ *  Shadow frame and burst flushing for many PCA9685 chips on one I2C bus.
+ *
+ *  BSD license, all text above must be included in any redistribution
+ */
+#ifndef _PCA9685_FLEET_H
+#define _PCA9685_FLEET_H
+
+#include "mbed_PWMServoDriver.h"
+#include "PCA9685Script.h"
+#include "PCA9685Batch.h"
+#if PCA9685_ENABLE_SEQLOCK
+#include <atomic>
+#endif
+
+#ifndef PCA9685_FLEET_MAX_CHIPS
+#define PCA9685_FLEET_MAX_CHIPS 8 /**< chips one fleet can hold */
+#endif
+#ifndef PCA9685_CACHE_LINE
+#define PCA9685_CACHE_LINE 32 /**< alignment of the shadow arrays */
+#endif
+#define PCA9685_FLEET_CHANNELS (PCA9685_FLEET_MAX_CHIPS * 16) /**< shadow size */
+
+#if PCA9685_ENABLE_QUARANTINE
+#ifndef PCA9685_QUARANTINE_SCORE
+#define PCA9685_QUARANTINE_SCORE 128 /**< error score that quarantines */
+#endif
+#ifndef PCA9685_REPROBE_US
+#define PCA9685_REPROBE_US 100000 /**< probe interval of a quarantined chip */
+#endif
+#endif
+
+#if PCA9685_ENABLE_FAULT_INJECTION
+#ifndef PCA9685_FAULT_HANG_US
+#define PCA9685_FAULT_HANG_US 25000 /**< injected bus hang, SMBus timeout */
+#endif
+#ifndef PCA9685_FAULT_STRETCH_US
+#define PCA9685_FAULT_STRETCH_US 2000 /**< injected clock stretching */
+#endif
+
+/*!
+ *  @brief  Faults a hook can inject into a fleet transaction
+ */
+enum PCA9685Fault {
+  PCA9685_FAULT_NONE,      /**< transaction runs normally */
+  PCA9685_FAULT_ADDR_NACK, /**< not sent, reported as address NACK */
+  PCA9685_FAULT_DATA_NACK, /**< first half sent, reported as data NACK */
+  PCA9685_FAULT_HANG,      /**< bus held for PCA9685_FAULT_HANG_US, NACK */
+  PCA9685_FAULT_STRETCH,   /**< delayed by PCA9685_FAULT_STRETCH_US, sent */
+};
+#endif
+
+#if PCA9685_ENABLE_STATS
+/*!
+ *  @brief  Fleet-wide update counters, for soak and stress runs. They are
+ * updated atomically, so they stay exact with several writing threads.
+ */
+struct PCA9685FleetStats {
+  uint32_t requested;   /**< setPWM() calls */
+  uint32_t suppressed;  /**< setPWM() calls that did not change the shadow */
+  uint32_t coalesced;   /**< changes that overwrote a not yet flushed change */
+  uint32_t transmitted; /**< dirty channels sent and acknowledged */
+  uint32_t failed;      /**< bursts that were not acknowledged */
+  uint32_t frames_lost; /**< flush(chip) calls that left channels unsent */
+  uint32_t recoveries;  /**< chips that acknowledged again after failing */
+  uint32_t recovery_last_us; /**< first failure to next ACK, last recovery */
+  uint32_t recovery_max_us;  /**< first failure to next ACK, worst case */
+  uint32_t quarantines;      /**< chips taken off the bus */
+  uint32_t reintegrations;   /**< quarantined chips restored */
+};
+#endif
+
+#if PCA9685_ENABLE_CHANNEL_STATS
+/*!
+ *  @brief  Per-channel update counters; they saturate at 65535
+ */
+struct PCA9685ChannelStats {
+  uint16_t requested;   /**< setPWM() calls */
+  uint16_t transmitted; /**< values sent and acknowledged */
+  uint16_t suppressed;  /**< setPWM() calls that did not change the value */
+  uint16_t coalesced;   /**< changes overwritten before they were sent */
+};
+#endif
+
+/*!
+ *  @brief  Structure-of-arrays shadow of every channel in a fleet of chips.
+ *
+ *  Channel c of chip i lives at index i * 16 + c of the ON and OFF arrays, so
+ *  diffing, dirty scanning and packing walk memory linearly. Per-chip
+ *  metadata lives in separate arrays and is not touched by the hot loops.
+ *  setPWM() only updates the shadow; flush() sends each chip's dirty
+ *  channels as auto-increment bursts, so chips must have MODE1_AI set (as
+ *  mbed_PWMServoDriver::begin() leaves them).
+ *
+ *  setPWM() for a given chip must come from one thread; flush() may run on
+ *  another one (e.g. a PCA9685Scheduler). flush() claims the dirty bits
+ *  atomically before copying the values, so a change made during a flush
+ *  is simply sent by the next one. With PCA9685_ENABLE_SEQLOCK, any number
+ *  of other threads may read the shadow
+ *  through getPWM() and snapshot() while it is written: each chip carries a
+ *  sequence counter that is odd while a write is in progress, readers retry
+ *  until they see the same even value before and after copying, and the
+ *  writer never waits.
+ *
+ *  With PCA9685_ENABLE_GROUPS the fleet caches each chip's MODE1. Code that
+ *  writes MODE1 of a fleet chip behind the fleet's back (e.g.
+ *  mbed_PWMServoDriver::sleep() on the same address) must call invalidate()
+ *  afterwards.
+ *
+ *  With PCA9685_ENABLE_QUARANTINE, a chip that NACKed has its MODE1 read
+ *  back before the next burst, and is reconfigured and sent its whole frame
+ *  if it came back from a power loss; chips that keep failing are
+ *  quarantined and probed the same way every PCA9685_REPROBE_US.
+ */
+class PCA9685Fleet {
+public:
+  PCA9685Fleet(I2C &i2c);
+  int add(uint8_t addr);
+  int reset(uint8_t prescale, uint8_t mode2 = MODE2_OUTDRV);
+  /*!
+   *  @brief  Number of chips added
+   *  @return chip count
+   */
+  uint8_t chips() const { return _count; }
+  /*!
+   *  @brief  7-bit address of a chip
+   *  @param  chip Index returned by add()
+   *  @return I2C address
+   */
+  uint8_t address(uint8_t chip) const { return _addr[chip] >> 1; }
+  void setPWM(uint8_t chip, uint8_t num, uint16_t on, uint16_t off);
+  void getPWM(uint8_t chip, uint8_t num, uint16_t *on, uint16_t *off);
+  void snapshot(uint8_t chip, uint16_t *on, uint16_t *off);
+  /*!
+   *  @brief  Channels of a chip waiting to be flushed
+   *  @param  chip Index returned by add()
+   *  @return bit n set if channel n is dirty
+   */
+  uint16_t dirty(uint8_t chip) const { return _dirty[chip]; }
+  int flush();
+  int flush(uint8_t chip, uint16_t mask = 0xFFFF);
+  int flush(PCA9685Batch &batch);
+  int verify(uint8_t chip);
+  void invalidate(uint8_t chip);
+  int run(const PCA9685Script &script, const uint8_t *args = NULL,
+          bool broadcast = false);
+#if PCA9685_ENABLE_QUARANTINE
+  /*!
+   *  @brief  Error score of a chip: NACKs raise it, acknowledged flushes
+   * decay it back to 0, and reaching PCA9685_QUARANTINE_SCORE quarantines
+   * the chip
+   *  @param  chip Index returned by add()
+   *  @return score from 0 (healthy) to 255
+   */
+  uint8_t health(uint8_t chip) const { return _score[chip]; }
+  /*!
+   *  @brief  Whether a chip is quarantined
+   *  @param  chip Index returned by add()
+   *  @return true while the fleet sends nothing but probes to the chip
+   */
+  bool quarantined(uint8_t chip) const { return _probe_at[chip] != 0; }
+#endif
+#if PCA9685_ENABLE_SOFT_START
+  int softStart(const uint16_t *rated_ma, uint32_t limit_ma,
+                chrono::milliseconds step);
+#endif
+#if PCA9685_ENABLE_STATS
+  PCA9685FleetStats stats() const;
+  void resetStats();
+#endif
+#if PCA9685_ENABLE_CHANNEL_STATS
+  void channelStats(uint8_t chip, PCA9685ChannelStats *stats);
+  /*!
+   *  @brief  Bytes put on the bus for a chip, including its address and
+   * register bytes; subaddress group bursts count towards the group's first
+   * chip
+   *  @param  chip Index returned by add()
+   *  @return bytes since construction or the last resetStats()
+   */
+  uint32_t bytesSent(uint8_t chip) const { return _bytes[chip]; }
+#endif
+#if PCA9685_ENABLE_TELEMETRY
+  void setTelemetry(PCA9685Telemetry *telemetry);
+#endif
+#if PCA9685_ENABLE_WATCHDOG
+  void setFailsafe(uint8_t chip, const uint16_t *off);
+  int sendFailsafe(uint8_t chip);
+  /*!
+   *  @brief  Time the chip last acknowledged a flush of its channels, or was
+   * asked by setPWM() for a value it had already acknowledged
+   *  @param  chip Index returned by add()
+   *  @return us_ticker_read() timestamp in microseconds
+   */
+  uint32_t lastWrite(uint8_t chip) const {
+    return core_util_atomic_load_u32(&_acked_us[chip]);
+  }
+#endif
+#if PCA9685_ENABLE_FAULT_INJECTION
+  /*!
+   *  @brief  Installs a hook consulted before every transaction, to inject
+   * scripted or random faults and measure recovery
+   *  @param  hook Returns the PCA9685Fault to apply to a chip's next
+   * transaction; an empty callback disables injection
+   */
+  void setFaultHook(Callback<PCA9685Fault(uint8_t)> hook) { _fault = hook; }
+#endif
+
+private:
+  int write(uint8_t chip, const char *data, int length, bool repeated = false);
+  uint16_t send(uint8_t chip, uint8_t addr, const uint16_t *on,
+                const uint16_t *off, uint16_t dirty, int *errors);
+#if PCA9685_ENABLE_GROUPS
+  int flushGroup(uint8_t leader);
+#endif
+  int wake(uint8_t chip);
+  void countSent(uint8_t chip, uint16_t sent, const uint16_t *on,
+                 const uint16_t *off);
+  int submit(PCA9685Batch &batch, uint8_t first, uint8_t end,
+             const uint16_t *claimed);
+  void settle(uint8_t chip, uint16_t dirty, uint16_t acked, int errors,
+              const uint16_t *on, const uint16_t *off);
+  int configure(uint8_t addr);
+#if PCA9685_ENABLE_QUARANTINE
+  void noteHealth(uint8_t chip, bool ok);
+  int restore(uint8_t chip);
+  int probe(uint8_t chip);
+  /* Quarantined, or NACKed since it last answered: only flush(chip) sends
+   * to it, which checks it first */
+  bool held(uint8_t chip) const { return _probe_at[chip] || _lapsed[chip]; }
+#endif
+
+  I2C *_i2c;
+  uint8_t _count;
+  alignas(PCA9685_CACHE_LINE) uint16_t _on[PCA9685_FLEET_CHANNELS];
+  alignas(PCA9685_CACHE_LINE) uint16_t _off[PCA9685_FLEET_CHANNELS];
+  alignas(PCA9685_CACHE_LINE) volatile uint16_t _dirty[PCA9685_FLEET_MAX_CHIPS];
+  alignas(PCA9685_CACHE_LINE) uint8_t _addr[PCA9685_FLEET_MAX_CHIPS];
+#if PCA9685_ENABLE_GROUPS
+  int16_t _mode1[PCA9685_FLEET_MAX_CHIPS]; // cached MODE1, -1 if unknown
+  uint8_t _groups[PCA9685_FLEET_MAX_CHIPS]; // bit g: member of SUBADR g+1
+#endif
+#if PCA9685_ENABLE_SEQLOCK
+  alignas(PCA9685_CACHE_LINE) std::atomic<uint32_t> _seq[PCA9685_FLEET_MAX_CHIPS];
+#endif
+#if PCA9685_ENABLE_STATS
+  PCA9685FleetStats _stats;
+  uint32_t _fail_since[PCA9685_FLEET_MAX_CHIPS];
+#endif
+  uint8_t _prescale; // from reset(), 0 if unknown
+  uint8_t _mode2;
+#if PCA9685_ENABLE_QUARANTINE
+  uint8_t _score[PCA9685_FLEET_MAX_CHIPS];
+  uint32_t _probe_at[PCA9685_FLEET_MAX_CHIPS]; // 0 if not quarantined
+  bool _lapsed[PCA9685_FLEET_MAX_CHIPS]; // NACKed, not checked since
+#endif
+#if PCA9685_ENABLE_CHANNEL_STATS
+  alignas(PCA9685_CACHE_LINE) PCA9685ChannelStats _channel[PCA9685_FLEET_CHANNELS];
+  uint32_t _bytes[PCA9685_FLEET_MAX_CHIPS];
+#endif
+#if PCA9685_ENABLE_TELEMETRY
+  PCA9685Telemetry *_telemetry;
+#endif
+#if PCA9685_ENABLE_WATCHDOG
+  volatile uint32_t _acked_us[PCA9685_FLEET_MAX_CHIPS];
+  char _failsafe[PCA9685_FLEET_MAX_CHIPS][1 + 4 * 16];
+  uint8_t _failsafe_len[PCA9685_FLEET_MAX_CHIPS];
+  volatile uint8_t _failsafed[PCA9685_FLEET_MAX_CHIPS]; // sent, not resumed
+#endif
+#if PCA9685_ENABLE_FAULT_INJECTION
+  Callback<PCA9685Fault(uint8_t)> _fault;
+#endif
+};
+
+#endif
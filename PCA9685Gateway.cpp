@@ -0,0 +1,164 @@
+/*!
+ *  @file PCA9685Gateway.cpp
+ *
+ *  BSD license, all text above must be included in any redistribution
+ */
+
+#include "mbed_PWMServoDriver.h"
+#if PCA9685_ENABLE_GATEWAY
+#include "PCA9685Gateway.h"
+
+/* Reads a varint of at most 3 bytes; returns bytes used, 0 if the buffer
+ * ends first or the varint is longer. */
+static uint8_t getVarint(const uint8_t *p, const uint8_t *end, uint32_t *v) {
+  *v = 0;
+  for (uint8_t i = 0; i < 3 && p + i < end; i++) {
+    *v |= (uint32_t)(p[i] & 0x7F) << (7 * i);
+    if (!(p[i] & 0x80))
+      return i + 1;
+  }
+  return 0;
+}
+
+static int32_t unzigzag(uint32_t v) { return (int32_t)(v >> 1) ^ -(int32_t)(v & 1); }
+
+/*!
+ *  @brief  Instantiates a gateway
+ *  @param  port  Serial link to the host, e.g. a BufferedSerial
+ *  @param  fleet Fleet the frames are applied to
+ */
+PCA9685Gateway::PCA9685Gateway(FileHandle &port, PCA9685Fleet &fleet)
+    : _port(&port), _fleet(&fleet), _len(0), _expected(0), _rejected(0) {}
+
+/*!
+ *  @brief  Reads whatever the port has and applies every complete message;
+ * the port should be non-blocking for this
+ *  @return number of messages applied
+ */
+int PCA9685Gateway::poll() {
+  int applied = 0;
+  for (;;) {
+    ssize_t n = _port->read(_buf + _len, sizeof(_buf) - _len);
+    if (n > 0)
+      _len += n;
+    int r;
+    while ((r = parse()) != 0)
+      applied += r > 0;
+    if (n <= 0 || _len < sizeof(_buf))
+      return applied;
+  }
+}
+
+/*!
+ *  @brief  Serves the host forever, blocking on the port
+ */
+void PCA9685Gateway::run() {
+  _port->set_blocking(true);
+  for (;;) {
+    ssize_t n = _port->read(_buf + _len, sizeof(_buf) - _len);
+    if (n > 0)
+      _len += n;
+    while (parse())
+      ;
+  }
+}
+
+/*!
+ *  @brief  Consumes one message or one byte of garbage from the buffer
+ *  @return 1 if a message was applied, -1 if bytes or a message were dropped,
+ * 0 if more bytes are needed
+ */
+int PCA9685Gateway::parse() {
+  if (!_len)
+    return 0;
+  if (_buf[0] != PCA9685_GATEWAY_SYNC) {
+    consume(1);
+    return -1;
+  }
+  if (_len < 6)
+    return 0;
+
+  uint8_t seq = _buf[1], flags = _buf[2], chip = _buf[3];
+  uint16_t mask = _buf[4] | _buf[5] << 8;
+  uint8_t values =
+      __builtin_popcount(mask) * ((flags & PCA9685_GATEWAY_ON) ? 2 : 1);
+  const uint8_t *p = _buf + 6, *end = _buf + _len;
+  uint32_t v[32];
+  for (uint8_t i = 0; i < values; i++) {
+    uint8_t n = getVarint(p, end, &v[i]);
+    if (!n && end - p < 3)
+      return 0;
+    if (!n) { // overlong, so this was not a message; resync on the next sync
+      _rejected++;
+      consume(1);
+      return -1;
+    }
+    p += n;
+  }
+  if (end - p < 2)
+    return 0;
+
+  uint32_t crc;
+  MbedCRC<POLY_16BIT_CCITT, 16> ct;
+  ct.compute(_buf + 1, p - _buf - 1, &crc);
+  if ((uint16_t)(p[0] | p[1] << 8) != (uint16_t)crc) {
+    _rejected++;
+    consume(1);
+    return -1;
+  }
+  if (seq != _expected) {
+    _rejected++;
+    reply(PCA9685_GATEWAY_NAK, _expected);
+    consume(p + 2 - _buf);
+    return -1;
+  }
+
+  // a well-formed message that cannot be applied is refused as a whole, and
+  // not NAKed, since sending it again would not change that
+  uint16_t on[16], off[16];
+  bool valid = chip < _fleet->chips();
+  uint8_t i = 0;
+  for (uint8_t num = 0; num < 16 && valid; num++) {
+    if (!(mask & (1 << num)))
+      continue;
+    _fleet->getPWM(chip, num, &on[num], &off[num]);
+    uint32_t to_on, to_off;
+    if (flags & PCA9685_GATEWAY_ABSOLUTE) {
+      to_on = (flags & PCA9685_GATEWAY_ON) ? v[i++] : on[num];
+      to_off = v[i++];
+    } else { // deltas wrap like the host's 16 bit arithmetic
+      to_on = (uint16_t)(on[num] +
+                         ((flags & PCA9685_GATEWAY_ON) ? unzigzag(v[i++]) : 0));
+      to_off = (uint16_t)(off[num] + unzigzag(v[i++]));
+    }
+    valid = to_on <= 4096 && to_off <= 4096; // bit 12 is full on/off
+    on[num] = to_on;
+    off[num] = to_off;
+  }
+  _expected = seq + 1;
+  consume(p + 2 - _buf);
+  for (uint8_t num = 0; num < 16 && valid; num++) {
+    if (mask & (1 << num))
+      _fleet->setPWM(chip, num, on[num], off[num]);
+  }
+  if (flags & PCA9685_GATEWAY_FLUSH) // the rest of the frame still goes out
+    _fleet->flush();
+  if (!valid) {
+    _rejected++;
+    reply(PCA9685_GATEWAY_REJECT, seq);
+    return -1;
+  }
+  reply(PCA9685_GATEWAY_ACK, seq);
+  return 1;
+}
+
+void PCA9685Gateway::consume(uint8_t n) {
+  _len -= n;
+  memmove(_buf, _buf + n, _len);
+}
+
+void PCA9685Gateway::reply(char type, uint8_t seq) {
+  const char msg[3] = {(char)PCA9685_GATEWAY_REPLY, type, (char)seq};
+  _port->write(msg, sizeof(msg));
+}
+#endif
@@ -0,0 +1,71 @@
+/*!
+ *  @file PCA9685Gateway.h
+ *
+ *  Receives binary frames from a host over a serial link and applies them to
+ *  a PCA9685Fleet. tools/pca9685_stream.py is the host side.
+ *
+ *  BSD license, all text above must be included in any redistribution
+ */
+#ifndef _PCA9685_GATEWAY_H
+#define _PCA9685_GATEWAY_H
+
+#include "PCA9685Fleet.h"
+
+#define PCA9685_GATEWAY_SYNC 0xA5  /**< first byte of a host message */
+#define PCA9685_GATEWAY_REPLY 0x5A /**< first byte of a gateway reply */
+#define PCA9685_GATEWAY_ACK 'A'    /**< reply: message applied */
+#define PCA9685_GATEWAY_NAK 'N'    /**< reply: resend from this sequence */
+#define PCA9685_GATEWAY_REJECT 'R' /**< reply: message can never be applied */
+
+#define PCA9685_GATEWAY_ON 0x01       /**< flag: ON deltas are included */
+#define PCA9685_GATEWAY_FLUSH 0x02    /**< flag: flush after applying */
+#define PCA9685_GATEWAY_ABSOLUTE 0x04 /**< flag: values are not deltas */
+
+/** header, 16 channels of two 3 byte varints, CRC */
+#define PCA9685_GATEWAY_MAX_MESSAGE (6 + 16 * 2 * 3 + 2)
+
+/*!
+ *  @brief  Applies host-computed frames to a fleet shadow.
+ *
+ *  A message updates the channels of one chip:
+ *  sync, seq, flags, chip, mask (16 bit LE), then per channel in the mask
+ *  varint(zigzag(on delta)) if PCA9685_GATEWAY_ON and
+ *  varint(zigzag(off delta)), then CRC-16/CCITT (LE) over seq..values.
+ *  Deltas are against the fleet shadow, which both sides mirror. The host
+ *  sets PCA9685_GATEWAY_FLUSH on the last message of a frame.
+ *
+ *  Every applied message is acknowledged with reply, 'A', seq. A corrupt or
+ *  out-of-order message is dropped and answered with reply, 'N', expected
+ *  seq; the host then resends from there (go-back-N). A message that arrived
+ *  intact but names a chip the fleet does not have, or would set a value
+ *  past 4096, is dropped as a whole and answered with reply, 'R', seq; its
+ *  sequence number counts as used, so the host must not resend it. The host
+ *  keeps at most a window of unacknowledged messages in flight, which is the
+ *  flow control.
+ */
+class PCA9685Gateway {
+public:
+  PCA9685Gateway(FileHandle &port, PCA9685Fleet &fleet);
+  int poll();
+  void run();
+  /*!
+   *  @brief  Messages dropped for a bad CRC, header or sequence number, or
+   * answered with PCA9685_GATEWAY_REJECT
+   *  @return rejected message count
+   */
+  uint32_t rejected() const { return _rejected; }
+
+private:
+  int parse();
+  void consume(uint8_t n);
+  void reply(char type, uint8_t seq);
+
+  FileHandle *_port;
+  PCA9685Fleet *_fleet;
+  uint8_t _buf[PCA9685_GATEWAY_MAX_MESSAGE];
+  uint8_t _len;
+  uint8_t _expected;
+  uint32_t _rejected;
+};
+
+#endif
@@ -0,0 +1,78 @@
+/*!
+ *  @file PCA9685Math.h
+ *
+ *  Time and frequency conversions of mbed_PWMServoDriver, free of any mbed
+ *  dependency so tools/conversion_accuracy.cpp can check them on a host.
+ *
+ *  BSD license, all text above must be included in any redistribution
+ */
+#ifndef _PCA9685_MATH_H
+#define _PCA9685_MATH_H
+
+#include <stdint.h>
+
+/*!
+ *  @brief  Prescale for a PWM frequency, clamped to the register range
+ *  @param  freq Frequency in Hz, clamped to 1..3500
+ *  @param  osc  Oscillator frequency in Hz
+ *  @return value for the PRESCALE register
+ */
+inline uint8_t pca9685Prescale(float freq, uint32_t osc) {
+  if (freq < 1)
+    freq = 1;
+  if (freq > 3500)
+    freq = 3500; // Datasheet limit is 3052=50MHz/(4*4095)
+  float prescale = ((osc / (freq * 4095.0)) + 0.5) - 1;
+  if (prescale < 3) // PCA9685_PRESCALE_MIN
+    prescale = 3;
+  if (prescale > 255) // PCA9685_PRESCALE_MAX
+    prescale = 255;
+  return (uint8_t)prescale;
+}
+
+/*!
+ *  @brief  Converts a duration to ticks from the oscillator and prescale
+ *  @param  us       Duration in microseconds
+ *  @param  osc      Oscillator frequency in Hz
+ *  @param  prescale PRESCALE register value
+ *  @return ticks, rounded to nearest and saturated at 65535
+ */
+constexpr uint16_t pca9685UsToTicks(uint32_t us, uint32_t osc, uint8_t prescale) {
+  uint64_t den = 1000000ULL * (prescale + 1u);
+  uint64_t ticks = ((uint64_t)us * osc + den / 2) / den;
+  return ticks > 0xFFFF ? 0xFFFF : (uint16_t)ticks;
+}
+
+/*!
+ *  @brief  Converts a duration to ticks from a measured PWM period
+ *  @param  us        Duration in microseconds
+ *  @param  period_us PWM period in microseconds
+ *  @return ticks, rounded to nearest and saturated at 65535
+ */
+constexpr uint16_t pca9685UsToTicksRef(uint32_t us, uint32_t period_us) {
+  uint64_t ticks = ((uint64_t)us * 4096 + period_us / 2) / period_us;
+  return ticks > 0xFFFF ? 0xFFFF : (uint16_t)ticks;
+}
+
+/*!
+ *  @brief  ON and OFF counts of a window within the PWM period
+ *  @param  start Start of the window in ticks; wraps at 4096
+ *  @param  width Width in ticks; 0 is fully off and 4096 or more fully on
+ *  @param  on    ON count, 4096 for fully on
+ *  @param  off   OFF count, 4096 for fully off
+ */
+inline void pca9685Window(uint16_t start, uint16_t width, uint16_t *on,
+                          uint16_t *off) {
+  if (width == 0) {
+    *on = 0;
+    *off = 4096;
+  } else if (width >= 4096) {
+    *on = 4096;
+    *off = 0;
+  } else {
+    *on = start % 4096;
+    *off = (*on + width) % 4096;
+  }
+}
+
+#endif
@@ -0,0 +1,99 @@
+/*!
+ *  @file PCA9685Renderer.cpp
+ *
+ *  BSD license, all text above must be included in any redistribution
+ */
+
+#include "mbed_PWMServoDriver.h"
+#if PCA9685_ENABLE_RENDERER
+#include "PCA9685Renderer.h"
+
+/*!
+ *  @brief  Instantiates a renderer; render() works on the calling thread
+ * alone until start() adds workers
+ *  @param  fleet  Fleet whose shadow the frames are rendered into
+ *  @param  effect Renders one chip of a frame; called concurrently for
+ * different chips
+ */
+PCA9685Renderer::PCA9685Renderer(PCA9685Fleet &fleet, PCA9685Effect effect)
+    : _fleet(&fleet), _effect(effect), _workers(0), _running(false), _go(0),
+      _done(0), _frame(0), _left(0), _next(0) {}
+
+PCA9685Renderer::~PCA9685Renderer() { stop(); }
+
+/*!
+ *  @brief  Starts the worker threads, typically one per core besides the
+ * caller of render()
+ *  @param  workers  Threads to start, at most PCA9685_RENDER_MAX_WORKERS
+ *  @param  priority Priority of the workers
+ *  @return false if workers is out of range or the renderer already runs
+ */
+bool PCA9685Renderer::start(uint8_t workers, osPriority priority) {
+  if (_workers || workers > PCA9685_RENDER_MAX_WORKERS)
+    return false;
+  _running = true;
+  for (_workers = 0; _workers < workers; _workers++) {
+    _threads[_workers] = new Thread(priority);
+    _threads[_workers]->start(callback(this, &PCA9685Renderer::run));
+  }
+  return true;
+}
+
+/*!
+ *  @brief  Stops and frees the worker threads
+ */
+void PCA9685Renderer::stop() {
+  if (!_workers)
+    return;
+  _running = false;
+  for (uint8_t i = 0; i < _workers; i++)
+    _go.release();
+  for (uint8_t i = 0; i < _workers; i++) {
+    _threads[i]->join();
+    delete _threads[i];
+  }
+  _workers = 0;
+}
+
+/*!
+ *  @brief  Renders every chip of a frame into the fleet shadow and returns
+ * once all of them are stored
+ *  @param  frame Frame number handed to the effect
+ */
+void PCA9685Renderer::render(uint32_t frame) {
+  uint8_t chips = _fleet->chips();
+  if (!chips)
+    return;
+  _frame = frame;
+  _left = chips;
+  _next = 0; // publishes the frame; workers woken late may start here
+  for (uint8_t i = 0; i < _workers && i + 1 < chips; i++)
+    _go.release();
+  work();
+  _done.acquire();
+}
+
+void PCA9685Renderer::run() {
+  for (;;) {
+    _go.acquire();
+    if (!_running)
+      return;
+    work();
+  }
+}
+
+/* Claims and renders chips until the frame has none left; whoever renders
+ * the last chip wakes render(). */
+void PCA9685Renderer::work() {
+  uint8_t chips = _fleet->chips();
+  uint8_t chip;
+  while ((chip = _next.fetch_add(1)) < chips) {
+    uint16_t on[16], off[16];
+    _effect(chip, _frame, on, off);
+    for (uint8_t num = 0; num < 16; num++)
+      _fleet->setPWM(chip, num, on[num], off[num]);
+    if (_left.fetch_sub(1) == 1)
+      _done.release();
+  }
+}
+#endif
@@ -0,0 +1,65 @@
+/*!
+ *  @file PCA9685Renderer.h
+ *
+ *  Renders effect frames into a PCA9685Fleet shadow on several threads.
+ *
+ *  BSD license, all text above must be included in any redistribution
+ */
+#ifndef _PCA9685_RENDERER_H
+#define _PCA9685_RENDERER_H
+
+#include "PCA9685Fleet.h"
+#include <atomic>
+
+#ifndef PCA9685_RENDER_MAX_WORKERS
+#define PCA9685_RENDER_MAX_WORKERS 4 /**< worker threads one renderer can run */
+#endif
+
+/*!
+ *  @brief  Computes one chip's 16 channels of a frame into on[] and off[]
+ */
+typedef Callback<void(uint8_t chip, uint32_t frame, uint16_t *on,
+                      uint16_t *off)>
+    PCA9685Effect;
+
+/*!
+ *  @brief  Spreads the chips of a fleet over a pool of worker threads that
+ * render each frame straight into the fleet shadow.
+ *
+ *  Every chip is one task. render() publishes the frame and the workers,
+ *  with the calling thread helping, claim chips from a shared counter until
+ *  none are left, so a slow chip never holds up the others' share. Each chip
+ *  is rendered on the stack and stored with PCA9685Fleet::setPWM(), which
+ *  only marks the channels that changed as dirty; whichever thread flushes
+ *  the fleet then sends them from the shadow, without copying the frame.
+ *
+ *  A chip is written by one thread at a time, and render() returns only once
+ *  every chip is done, so the fleet's single-writer rule per chip holds.
+ *  The fleet-wide PCA9685FleetStats counters are updated atomically and the
+ *  per-channel ones by each chip's single writer, so both stay exact.
+ */
+class PCA9685Renderer {
+public:
+  PCA9685Renderer(PCA9685Fleet &fleet, PCA9685Effect effect);
+  ~PCA9685Renderer();
+  bool start(uint8_t workers, osPriority priority = osPriorityNormal);
+  void stop();
+  void render(uint32_t frame);
+
+private:
+  void run();
+  void work();
+
+  PCA9685Fleet *_fleet;
+  PCA9685Effect _effect;
+  Thread *_threads[PCA9685_RENDER_MAX_WORKERS];
+  uint8_t _workers;
+  volatile bool _running;
+  Semaphore _go;
+  Semaphore _done;
+  uint32_t _frame;
+  std::atomic<uint8_t> _left; // chips of the frame not yet rendered
+  std::atomic<uint8_t> _next; // next chip to claim
+};
+
+#endif
@@ -0,0 +1,293 @@
+/*!
+ *  @file PCA9685Scheduler.cpp
+ *
+ *  BSD license, all text above must be included in any redistribution
+ */
+
+#include "mbed_PWMServoDriver.h"
+#if PCA9685_ENABLE_SCHEDULER
+#include "PCA9685Scheduler.h"
+
+/*!
+ *  @brief  Instantiates a scheduler; every chip starts untimed
+ *  @param  fleet    Fleet to flush
+ *  @param  bus_hz   I2C clock, used to estimate burst duration
+ *  @param  priority Priority of the thread started by start()
+ */
+PCA9685Scheduler::PCA9685Scheduler(PCA9685Fleet &fleet, uint32_t bus_hz,
+                                   osPriority priority)
+    : _fleet(&fleet), _bus_hz(bus_hz), _thread(priority),
+      _interval(0), _running(false), _overruns(0) {
+  memset(_period_ns, 0, sizeof(_period_ns));
+  memset(_observed_us, 0, sizeof(_observed_us));
+  memset(_members, 0, sizeof(_members));
+  for (uint8_t chip = 0; chip < PCA9685_FLEET_MAX_CHIPS; chip++)
+    _members[chip][0] = 0xFFFF;
+  memset(_divisor, 1, sizeof(_divisor));
+  memset(_phase, 0, sizeof(_phase));
+  memset(_slot, 0, sizeof(_slot));
+}
+
+/*!
+ *  @brief  Sets a chip's cycle model
+ *  @param  chip       Index returned by PCA9685Fleet::add()
+ *  @param  prescale   Value in PCA9685_PRESCALE
+ *  @param  oscillator Calibrated oscillator frequency in Hz
+ *  @param  restart_us us_ticker_read() time of the last wake or restart,
+ * when the counter started at 0
+ */
+void PCA9685Scheduler::setCycle(uint8_t chip, uint8_t prescale,
+                                uint32_t oscillator, uint32_t restart_us) {
+  _period_ns[chip] =
+      (uint32_t)(4096ULL * (prescale + 1) * 1000000000ULL / oscillator);
+  _origin_us[chip] = restart_us;
+  _observed_us[chip] = 0;
+}
+
+/*!
+ *  @brief  Feeds back a measured cycle start, e.g. the rising edge of an
+ * ON = 0 output captured by an InterruptIn. The phase snaps to it, and two
+ * observations far enough apart also correct the period for oscillator drift.
+ *  @param  chip           Index returned by PCA9685Fleet::add()
+ *  @param  cycle_start_us us_ticker_read() time of the cycle start
+ */
+void PCA9685Scheduler::notePhase(uint8_t chip, uint32_t cycle_start_us) {
+  uint32_t period = _period_ns[chip];
+  uint32_t last = _observed_us[chip];
+  if (period && last) {
+    uint64_t span_ns = (uint64_t)(cycle_start_us - last) * 1000;
+    uint32_t cycles = (span_ns + period / 2) / period;
+    if (cycles >= 8) // enough for sub-microsecond resolution
+      _period_ns[chip] = span_ns / cycles;
+  }
+  _origin_us[chip] = cycle_start_us;
+  _observed_us[chip] = cycle_start_us | 1; // 0 means none
+}
+
+/*!
+ *  @brief  Predicts the next cycle boundary of a chip
+ *  @param  chip   Index returned by PCA9685Fleet::add()
+ *  @param  now_us Current us_ticker_read() time
+ *  @return us_ticker_read() time of the first boundary after now_us, or
+ * now_us for an untimed chip
+ */
+uint32_t PCA9685Scheduler::nextBoundary(uint8_t chip, uint32_t now_us) {
+  uint32_t period = _period_ns[chip];
+  if (!period)
+    return now_us;
+  uint64_t elapsed_ns = (uint64_t)(now_us - _origin_us[chip]) * 1000;
+  uint64_t cycles = elapsed_ns / period;
+  if (cycles > 1024) // keep the origin recent, well clear of ticker wrap
+    _origin_us[chip] += (uint32_t)((cycles - 1) * period / 1000);
+  return now_us + (uint32_t)((period - elapsed_ns % period) / 1000);
+}
+
+/* Time to start a chip's burst so that it ends just before a boundary. */
+uint32_t PCA9685Scheduler::sendTime(uint8_t chip, uint16_t mask,
+                                    uint32_t now_us) {
+  if (!_period_ns[chip])
+    return now_us;
+  // address, register, then 4 bytes per channel, 9 bits per byte
+  uint32_t bits =
+      9 * (2 + 4 * __builtin_popcount(_fleet->dirty(chip) & mask));
+  uint32_t lead = bits * 1000000ULL / _bus_hz + PCA9685_ALIGN_GUARD_US;
+  uint32_t boundary = nextBoundary(chip, now_us + lead);
+  return boundary - lead;
+}
+
+/*!
+ *  @brief  Flushes every dirty chip, each at the end of its own cycle, in
+ * order of their send times. Blocks for at most about one PWM period,
+ * sleeping on a thread flag until each send time.
+ *  @return number of transactions that were not acknowledged
+ */
+int PCA9685Scheduler::flushAligned() {
+  uint16_t masks[PCA9685_FLEET_MAX_CHIPS];
+  for (uint8_t chip = 0; chip < PCA9685_FLEET_MAX_CHIPS; chip++)
+    masks[chip] = 0xFFFF;
+  return flushAligned(masks);
+}
+
+/* flushAligned() limited to the channels in masks[chip]. */
+int PCA9685Scheduler::flushAligned(const uint16_t *masks) {
+  uint8_t chips = _fleet->chips();
+  uint32_t when[PCA9685_FLEET_MAX_CHIPS];
+  bool pending[PCA9685_FLEET_MAX_CHIPS];
+  uint32_t now = us_ticker_read();
+  int errors = 0;
+  uint8_t left = 0;
+
+  for (uint8_t chip = 0; chip < chips; chip++) {
+    pending[chip] = (_fleet->dirty(chip) & masks[chip]) != 0;
+    if (pending[chip]) {
+      when[chip] = sendTime(chip, masks[chip], now);
+      left++;
+    }
+  }
+  while (left--) {
+    uint8_t next = 0;
+    uint32_t soonest = 0xFFFFFFFF;
+    for (uint8_t chip = 0; chip < chips; chip++) {
+      if (pending[chip] && when[chip] - now < soonest) {
+        soonest = when[chip] - now;
+        next = chip;
+      }
+    }
+    pending[next] = false;
+    int32_t wait = (int32_t)(when[next] - us_ticker_read());
+    if (wait > 0) {
+      _waiter = ThisThread::get_id();
+      _wake.attach(callback(this, &PCA9685Scheduler::wakeUp),
+                   chrono::microseconds(wait));
+      ThisThread::flags_wait_any(PCA9685_SCHEDULER_FLAG);
+    }
+    errors += _fleet->flush(next, masks[next]);
+  }
+  return errors;
+}
+
+/* Interrupt context: the send time of the next burst has come. */
+void PCA9685Scheduler::wakeUp() {
+  osThreadFlagsSet(_waiter, PCA9685_SCHEDULER_FLAG);
+}
+
+/*!
+ *  @brief  Moves channels into a refresh group. Call before start().
+ *  @param  chip     Index returned by PCA9685Fleet::add()
+ *  @param  channels Bit n set to move channel n
+ *  @param  group    0 to PCA9685_REFRESH_GROUPS - 1
+ */
+void PCA9685Scheduler::assign(uint8_t chip, uint16_t channels,
+                              uint8_t group) {
+  for (uint8_t g = 0; g < PCA9685_REFRESH_GROUPS; g++)
+    _members[chip][g] &= ~channels;
+  _members[chip][group] |= channels;
+  balance();
+}
+
+/*!
+ *  @brief  Sets how often a refresh group is flushed. Call before start().
+ *  @param  group   0 to PCA9685_REFRESH_GROUPS - 1
+ *  @param  divisor Flush the group every divisor ticks, e.g. 20 for 10 Hz
+ * with a 5 ms tick
+ */
+void PCA9685Scheduler::setRate(uint8_t group, uint8_t divisor) {
+  _divisor[group] = divisor ? divisor : 1;
+  balance();
+}
+
+/* Places the groups one after another, fastest first, each at the phase
+ * where the busiest of its ticks carries the fewest channels so far. The
+ * load is counted over 256 ticks, which covers every pattern that repeats
+ * within that, and over the chips added so far: assign() and setRate()
+ * balance again, so assign after adding. */
+void PCA9685Scheduler::balance() {
+  uint16_t weight[PCA9685_REFRESH_GROUPS];
+  bool placed[PCA9685_REFRESH_GROUPS];
+  uint8_t chips = _fleet->chips();
+  for (uint8_t g = 0; g < PCA9685_REFRESH_GROUPS; g++) {
+    weight[g] = 0;
+    for (uint8_t chip = 0; chip < chips; chip++)
+      weight[g] += __builtin_popcount(_members[chip][g]);
+    placed[g] = false;
+    _slot[g] = 0;
+  }
+  for (uint8_t n = 0; n < PCA9685_REFRESH_GROUPS; n++) {
+    uint8_t group = 0, divisor = 0xFF;
+    for (uint8_t g = 0; g < PCA9685_REFRESH_GROUPS; g++) {
+      if (!placed[g] && _divisor[g] <= divisor) {
+        divisor = _divisor[g];
+        group = g;
+      }
+    }
+    uint32_t best = 0xFFFFFFFF;
+    for (uint8_t phase = 0; phase < divisor; phase++) {
+      uint32_t peak = 0, total = 0;
+      for (uint16_t t = phase; t < 256; t += divisor) {
+        uint32_t load = 0;
+        for (uint8_t g = 0; g < PCA9685_REFRESH_GROUPS; g++) {
+          if (placed[g] && t % _divisor[g] == _phase[g])
+            load += weight[g];
+        }
+        peak = load > peak ? load : peak;
+        total += load;
+      }
+      // lowest peak first, then least total load
+      uint32_t cost = peak << 16 | (total < 0xFFFF ? total : 0xFFFF);
+      if (cost < best) {
+        best = cost;
+        _phase[group] = phase;
+      }
+    }
+    placed[group] = true;
+  }
+}
+
+/*!
+ *  @brief  Runs one tick of the cyclic executive: flushes, aligned to each
+ * chip's cycle, the channels of every refresh group due at this tick
+ *  @return number of transactions that were not acknowledged
+ */
+int PCA9685Scheduler::tick() {
+  uint16_t masks[PCA9685_FLEET_MAX_CHIPS];
+  memset(masks, 0, sizeof(masks));
+  due(masks);
+  return flushAligned(masks);
+}
+
+/* Advances the tick count and adds the channels of the groups due at this
+ * tick to masks. */
+void PCA9685Scheduler::due(uint16_t *masks) {
+  uint8_t chips = _fleet->chips();
+  for (uint8_t g = 0; g < PCA9685_REFRESH_GROUPS; g++) {
+    if (_slot[g] == _phase[g]) {
+      for (uint8_t chip = 0; chip < chips; chip++)
+        masks[chip] |= _members[chip][g];
+    }
+    if (++_slot[g] >= _divisor[g])
+      _slot[g] = 0;
+  }
+}
+
+/*!
+ *  @brief  Starts flushing on the scheduler's thread. A tick waits for each
+ * chip's cycle boundary, so it can take up to one PWM period plus the bus
+ * time of its bursts; an interval shorter than that overruns on every tick.
+ * A tick that runs into the next one is counted by overruns(), and the
+ * groups of any tick skipped meanwhile are sent with the late one.
+ *  @param  interval Time between two ticks, i.e. the period of the fastest
+ * refresh group (5 ms for 200 Hz), longer than one PWM period
+ */
+void PCA9685Scheduler::start(chrono::milliseconds interval) {
+  _interval = interval;
+  _running = true;
+  _thread.start(callback(this, &PCA9685Scheduler::run));
+}
+
+/*!
+ *  @brief  Stops the scheduler's thread after its current flush
+ */
+void PCA9685Scheduler::stop() {
+  _running = false;
+  _thread.join();
+}
+
+void PCA9685Scheduler::run() {
+  uint16_t masks[PCA9685_FLEET_MAX_CHIPS];
+  memset(masks, 0, sizeof(masks));
+  Kernel::Clock::time_point next = Kernel::Clock::now();
+  while (_running) {
+    due(masks);
+    flushAligned(masks);
+    memset(masks, 0, sizeof(masks));
+    next += _interval;
+    Kernel::Clock::time_point now = Kernel::Clock::now();
+    if (now > next) { // the next tick starts late
+      _overruns++;
+      for (; now >= next + _interval; next += _interval)
+        due(masks); // a tick missed entirely goes out with it
+    }
+    ThisThread::sleep_until(next);
+  }
+}
+#endif
@@ -0,0 +1,93 @@
+/*!
+ *  @file PCA9685Scheduler.h
+ *
+ *  Refresh scheduler that times fleet flushes against each chip's PWM cycle.
+ *
+ *  BSD license, all text above must be included in any redistribution
+ */
+#ifndef _PCA9685_SCHEDULER_H
+#define _PCA9685_SCHEDULER_H
+
+#include "PCA9685Fleet.h"
+
+#ifndef PCA9685_ALIGN_GUARD_US
+#define PCA9685_ALIGN_GUARD_US 100 /**< margin before a cycle boundary */
+#endif
+
+#ifndef PCA9685_SCHEDULER_FLAG
+#define PCA9685_SCHEDULER_FLAG (1u << 30) /**< thread flag of the wake-up */
+#endif
+
+#ifndef PCA9685_REFRESH_GROUPS
+#define PCA9685_REFRESH_GROUPS 4 /**< refresh groups per scheduler */
+#endif
+
+/*!
+ *  @brief  Flushes a PCA9685Fleet so that each chip's update lands just
+ * before the end of its PWM cycle.
+ *
+ *  Outputs take register changes on the I2C STOP, so an update landing while
+ *  a pulse is high cuts or stretches that pulse for one cycle. Pulses start
+ *  at the cycle boundary for ON = 0 channels, and the end of the cycle is
+ *  the latest quiet point. The scheduler therefore times each chip's burst
+ *  to end PCA9685_ALIGN_GUARD_US before the next boundary. It predicts the
+ *  boundary from the restart time, prescale and calibrated oscillator, and
+ *  notePhase() refines the prediction from measured cycle starts. Chips
+ *  without timing are flushed immediately. Between bursts the flushing
+ *  thread blocks on PCA9685_SCHEDULER_FLAG, set by a Timeout at the send
+ *  time, so lower priority threads keep the CPU while it waits.
+ *
+ *  Channels belong to one of PCA9685_REFRESH_GROUPS refresh groups, all in
+ *  group 0 at first. Each tick of the scheduler's thread flushes the groups
+ *  that are due, every chip's due channels together in as few bursts as
+ *  possible. A group set to refresh every nth tick gets the phase that
+ *  evens out the channels sent per tick, so slow groups share out the ticks
+ *  between them instead of all landing on the same one.
+ */
+class PCA9685Scheduler {
+public:
+  PCA9685Scheduler(PCA9685Fleet &fleet, uint32_t bus_hz = 400000,
+                   osPriority priority = osPriorityHigh);
+  void setCycle(uint8_t chip, uint8_t prescale, uint32_t oscillator,
+                uint32_t restart_us);
+  void notePhase(uint8_t chip, uint32_t cycle_start_us);
+  uint32_t nextBoundary(uint8_t chip, uint32_t now_us);
+  int flushAligned();
+  void assign(uint8_t chip, uint16_t channels, uint8_t group);
+  void setRate(uint8_t group, uint8_t divisor);
+  int tick();
+  void start(chrono::milliseconds interval);
+  void stop();
+  /*!
+   *  @brief  Ticks of the scheduler's thread that ran past the start of the
+   * next one, since construction
+   *  @return overrun count
+   */
+  uint32_t overruns() const { return _overruns; }
+
+private:
+  void run();
+  void wakeUp();
+  void balance();
+  void due(uint16_t *masks);
+  int flushAligned(const uint16_t *masks);
+  uint32_t sendTime(uint8_t chip, uint16_t mask, uint32_t now_us);
+
+  PCA9685Fleet *_fleet;
+  uint32_t _bus_hz;
+  Thread _thread;
+  chrono::milliseconds _interval;
+  volatile bool _running;
+  volatile uint32_t _overruns;
+  Timeout _wake;
+  osThreadId_t _waiter; // thread blocked in flushAligned()
+  uint32_t _origin_us[PCA9685_FLEET_MAX_CHIPS];   // a cycle start
+  uint32_t _period_ns[PCA9685_FLEET_MAX_CHIPS];   // 0 if untimed
+  uint32_t _observed_us[PCA9685_FLEET_MAX_CHIPS]; // last notePhase(), or 0
+  uint16_t _members[PCA9685_FLEET_MAX_CHIPS][PCA9685_REFRESH_GROUPS];
+  uint8_t _divisor[PCA9685_REFRESH_GROUPS]; // refreshed every nth tick
+  uint8_t _phase[PCA9685_REFRESH_GROUPS];   // ... when _slot reaches this
+  uint8_t _slot[PCA9685_REFRESH_GROUPS];    // tick count modulo _divisor
+};
+
+#endif
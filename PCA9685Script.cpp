@@ -0,0 +1,84 @@
+/*!
+ *  @file PCA9685Script.cpp
+ *
+ *  BSD license, all text above must be included in any redistribution
+ */
+
+#include "PCA9685Script.h"
+
+/*!
+ *  @brief  Runs the script, stopping at the first failed operation
+ *  @param  i2c   Bus the chip is on
+ *  @param  addr  8-bit address, of one chip or a broadcast address; a
+ * broadcast script must not read
+ *  @param  args  Values for PCA9685_WRITE_ARG()
+ *  @param  wrote Called with every register and value written, e.g. to keep
+ * a shadow in step
+ *  @return 0 on success, otherwise 1 + the offset of the operation that was
+ * not acknowledged, whose PCA9685_EXPECT() did not match or that is not valid
+ * byte code (e.g. a burst longer than PCA9685_SCRIPT_MAX_BURST)
+ */
+int PCA9685Script::run(I2C &i2c, uint8_t addr, const uint8_t *args,
+                       Callback<void(uint8_t, uint8_t)> wrote) const {
+  char buf[1 + PCA9685_SCRIPT_MAX_BURST];
+  uint8_t acc = 0;
+  const uint8_t *pc = _code;
+
+  for (;;) {
+    const uint8_t *op = pc;
+    uint8_t len = 0;
+    bool ok = true;
+    switch (*pc++) {
+    case PCA9685_OP_END:
+      return 0;
+    case PCA9685_OP_WRITE:
+      len = *pc++;
+      if (len > PCA9685_SCRIPT_MAX_BURST) // not built by PCA9685_WRITE()
+        return 1 + (op - _code);
+      memcpy(buf, pc, 1 + len);
+      pc += 1 + len;
+      break;
+    case PCA9685_OP_WRITE_ARG:
+      buf[0] = pc[0];
+      buf[1] = args[pc[1]];
+      len = 1;
+      pc += 2;
+      break;
+    case PCA9685_OP_STORE:
+      buf[0] = pc[0];
+      buf[1] = (acc & ~pc[1]) | pc[2];
+      len = 1;
+      pc += 3;
+      break;
+    case PCA9685_OP_LOAD:
+    case PCA9685_OP_EXPECT:
+      buf[0] = *pc++;
+      ok = !i2c.write(addr, buf, 1, true) && !i2c.read(addr, buf + 1, 1);
+      if (*op == PCA9685_OP_LOAD) {
+        acc = buf[1];
+      } else {
+        ok = ok && ((uint8_t)buf[1] & pc[0]) == pc[1];
+        pc += 2;
+      }
+      break;
+    case PCA9685_OP_WAIT: {
+      uint16_t us = pc[0] | pc[1] << 8;
+      pc += 2;
+      if (us >= 1000)
+        ThisThread::sleep_for(chrono::milliseconds((us + 999) / 1000));
+      else
+        wait_us(us);
+      break;
+    }
+    default: // not a script
+      return 1 + (op - _code);
+    }
+    if (len) {
+      ok = !i2c.write(addr, buf, 1 + len);
+      for (uint8_t i = 0; wrote && i < len; i++)
+        wrote((uint8_t)buf[0] + i, buf[1 + i]);
+    }
+    if (!ok)
+      return 1 + (op - _code);
+  }
+}
@@ -0,0 +1,83 @@
+/*!
+ *  @file PCA9685Script.h
+ *
+ *  Register transaction scripts: configuration sequences stored as constant
+ *  byte code and run by a small interpreter against any chip address.
+ *
+ *  BSD license, all text above must be included in any redistribution
+ */
+#ifndef _PCA9685_SCRIPT_H
+#define _PCA9685_SCRIPT_H
+
+#include "mbed_PWMServoDriver.h"
+
+// OPCODES
+#define PCA9685_OP_END 0x00       /**< end of script */
+#define PCA9685_OP_WRITE 0x01     /**< n, reg, n data bytes: one burst */
+#define PCA9685_OP_WRITE_ARG 0x02 /**< reg, i: write run-time argument i */
+#define PCA9685_OP_LOAD 0x03      /**< reg: read reg into the accumulator */
+#define PCA9685_OP_STORE 0x04     /**< reg, clear, set: write modified acc */
+#define PCA9685_OP_EXPECT 0x05    /**< reg, mask, value: read and check */
+#define PCA9685_OP_WAIT 0x06      /**< microseconds, 16 bit LE */
+
+#define PCA9685_SCRIPT_MAX_BURST 64 /**< data bytes of one WRITE */
+
+/*!
+ *  @brief  Number of arguments, for PCA9685_WRITE(); longer bursts than
+ * PCA9685_SCRIPT_MAX_BURST do not compile
+ */
+template <typename... T> constexpr uint8_t pca9685Count(T...) {
+  static_assert(sizeof...(T) <= PCA9685_SCRIPT_MAX_BURST,
+                "PCA9685_WRITE() burst longer than PCA9685_SCRIPT_MAX_BURST");
+  return sizeof...(T);
+}
+
+// BUILDERS, to list in a static const uint8_t[] so the script stays in flash
+/** Writes the data bytes from reg on, in one burst (MODE1_AI for more than 1) */
+#define PCA9685_WRITE(reg, ...)                                                \
+  PCA9685_OP_WRITE, pca9685Count(__VA_ARGS__), (reg), __VA_ARGS__
+/** Writes argument i of the run() call to reg */
+#define PCA9685_WRITE_ARG(reg, i) PCA9685_OP_WRITE_ARG, (reg), (i)
+/** Reads reg into the accumulator */
+#define PCA9685_LOAD(reg) PCA9685_OP_LOAD, (reg)
+/** Writes (accumulator & ~clear) | set to reg; the accumulator is kept */
+#define PCA9685_STORE(reg, clear, set) PCA9685_OP_STORE, (reg), (clear), (set)
+/** Reads reg and fails the script unless (reg & mask) == value */
+#define PCA9685_EXPECT(reg, mask, value)                                       \
+  PCA9685_OP_EXPECT, (reg), (mask), (value)
+/** Waits; sleeps the thread from 1 ms on */
+#define PCA9685_WAIT_US(us) PCA9685_OP_WAIT, (us) & 0xFF, ((us) >> 8) & 0xFF
+/** Ends the script */
+#define PCA9685_END PCA9685_OP_END
+
+/*!
+ *  @brief  Runs a byte-coded register script against one address.
+ *
+ *  A script is a constant array built from the PCA9685_WRITE() family of
+ *  macros, e.g.
+ *
+ *      static const uint8_t SLEEP[] = {
+ *          PCA9685_LOAD(PCA9685_MODE1),
+ *          PCA9685_STORE(PCA9685_MODE1, MODE1_RESTART, MODE1_SLEEP),
+ *          PCA9685_WAIT_US(5000), PCA9685_END};
+ *
+ *  so a configuration sequence is written once, lives in flash and can be
+ *  run on any chip, or with writes only on the LED All Call or a subaddress
+ *  to configure many chips with one transaction per step. Values that are
+ *  only known at run time come from the args of run().
+ */
+class PCA9685Script {
+public:
+  /*!
+   *  @brief  Wraps a script
+   *  @param  code Byte code ending in PCA9685_END; it is not copied
+   */
+  PCA9685Script(const uint8_t *code) : _code(code) {}
+  int run(I2C &i2c, uint8_t addr, const uint8_t *args = NULL,
+          Callback<void(uint8_t, uint8_t)> wrote = nullptr) const;
+
+private:
+  const uint8_t *_code;
+};
+
+#endif
@@ -0,0 +1,196 @@
+/*!
+ *  @file PCA9685Spline.cpp
+ *
+ *  BSD license, all text above must be included in any redistribution
+ */
+
+#include "mbed_PWMServoDriver.h"
+#if PCA9685_ENABLE_SPLINE
+#include "PCA9685Spline.h"
+
+#define ONE ((int64_t)1 << 32) /* 1.0 in 32.32 fixed point */
+
+/* Rounded division of a signed 32.32 value. */
+static inline int64_t divide(int64_t n, int64_t d) {
+  return (n + (n < 0 ? -d / 2 : d / 2)) / d;
+}
+
+/* The forward differences are 32.64 values: a 32.32 high part and 32 more
+ * fraction bits, so the error of the cubic term stays far below a count
+ * over 65535 ticks. The target has no 128-bit type, hence these helpers. */
+
+/* hi:lo += bhi:blo */
+static inline void add(int64_t &hi, uint32_t &lo, int64_t bhi, uint32_t blo) {
+  uint32_t sum = lo + blo;
+  hi += bhi + (sum < lo);
+  lo = sum;
+}
+
+/* hi:lo *= k, for a small positive k */
+static inline void scale(int64_t &hi, uint32_t &lo, uint32_t k) {
+  uint64_t low = (uint64_t)lo * k;
+  hi = hi * k + (int64_t)(low >> 32);
+  lo = (uint32_t)low;
+}
+
+/* hi:lo = n / d, truncated, for a signed 32.32 n and 0 < d < 2^48. The
+ * remainder is carried into the extra bits 16 at a time so it cannot
+ * overflow. */
+static void divideWide(int64_t n, uint64_t d, int64_t &hi, uint32_t &lo) {
+  uint64_t u = n < 0 ? -(uint64_t)n : (uint64_t)n;
+  uint64_t q = u / d, r = u % d;
+  uint64_t f1 = (r << 16) / d;
+  r = (r << 16) % d;
+  uint64_t f2 = (r << 16) / d;
+  hi = (int64_t)q;
+  lo = (uint32_t)(f1 << 16 | f2);
+  if (n < 0) { // negate the 96-bit value
+    hi = -hi - (lo != 0);
+    lo = -lo;
+  }
+}
+
+/*!
+ *  @brief  Instantiates an empty spline set
+ *  @param  fleet Fleet whose shadow the tracks write
+ */
+PCA9685Spline::PCA9685Spline(PCA9685Fleet &fleet) : _fleet(&fleet) {
+  for (uint8_t t = 0; t < PCA9685_SPLINE_MAX_TRACKS; t++)
+    _keys[t] = nullptr;
+}
+
+/*!
+ *  @brief  Starts a channel along a path; the next tick() sets the channel
+ * to the first keyframe and the one after takes the first step from it
+ *  @param  channel Fleet channel, chip * 16 + channel
+ *  @param  keys    Keyframes; the ticks of the last one are only used when
+ * looping, to return to the first
+ *  @param  count   Number of keyframes, at least 2
+ *  @param  loop    Run the path forever instead of stopping at the end
+ *  @return track index, or -1 if every track is in use or count is too low
+ */
+int PCA9685Spline::attach(uint16_t channel, const PCA9685Keyframe *keys,
+                          uint8_t count, bool loop) {
+  if (count < 2)
+    return -1;
+  for (uint8_t t = 0; t < PCA9685_SPLINE_MAX_TRACKS; t++) {
+    if (_keys[t])
+      continue;
+    _channel[t] = channel;
+    _count[t] = count;
+    _loop[t] = loop;
+    _segment[t] = loop ? count - 1 : 0xFF; // begin() moves to keyframe 0
+    _left[t] = 0;
+    _start[t] = true;
+    _value[t] = (int64_t)keys[0].value << 32;
+    _keys[t] = keys;
+    return t;
+  }
+  return -1;
+}
+
+/*!
+ *  @brief  Stops a track and frees it; the channel keeps its last value
+ *  @param  track Index returned by attach()
+ */
+void PCA9685Spline::detach(uint8_t track) { _keys[track] = nullptr; }
+
+/*!
+ *  @brief  Advances every track by one tick and stores the values in the
+ * fleet shadow; call at a fixed rate and flush the fleet after it
+ */
+void PCA9685Spline::tick() {
+  for (uint8_t t = 0; t < PCA9685_SPLINE_MAX_TRACKS; t++) {
+    if (!_keys[t])
+      continue;
+    if (_start[t]) { // show keyframe 0 before stepping away from it
+      _start[t] = false;
+    } else {
+      if (!_left[t] && !begin(t))
+        continue;
+      _value[t] += _d1[t];
+      add(_d1[t], _d1_lo[t], _d2[t], _d2_lo[t]);
+      add(_d2[t], _d2_lo[t], _d3[t], _d3_lo[t]);
+      if (!--_left[t]) // land exactly on the keyframe
+        _value[t] = (int64_t)key(t, _segment[t] + 1) << 32;
+    }
+    int64_t v = (_value[t] + ONE / 2) >> 32;
+    uint16_t n = _channel[t];
+    _fleet->setPWM(n >> 4, n & 15, 0, v < 0 ? 0 : v > 4095 ? 4095 : v);
+  }
+}
+
+/* Value of keyframe k of a track, wrapping when the track loops. */
+uint16_t PCA9685Spline::key(uint8_t track, uint8_t k) const {
+  return _keys[track][k % _count[track]].value;
+}
+
+/* Slope at a keyframe in 32.32 counts per tick: the chord between its
+ * neighbours over the time between them, or zero at the ends of a path that
+ * does not loop. */
+int64_t PCA9685Spline::tangent(uint8_t track, uint8_t k) {
+  const PCA9685Keyframe *keys = _keys[track];
+  uint8_t count = _count[track];
+  if (!_loop[track] && (k == 0 || k >= count - 1))
+    return 0;
+  uint8_t prev = k ? k - 1 : count - 1;
+  uint32_t ticks = keys[prev].ticks + keys[k % count].ticks;
+  if (!ticks)
+    return 0;
+  int64_t rise = (int64_t)key(track, k + 1) - keys[prev].value;
+  return divide(rise << 32, ticks);
+}
+
+/* Moves a track to its next segment and seeds the forward differences of
+ * P(j) = p0 + m0 j + B j^2 + A j^3 for the segment's n ticks:
+ * A = (2 (p0 - p1) + (m0 + m1) n) / n^3, B = (3 (p1 - p0) - (2 m0 + m1) n) / n^2
+ * Returns false, freeing the track, at the end of a path that does not
+ * loop. Keyframes with zero ticks are jumped over. */
+bool PCA9685Spline::begin(uint8_t track) {
+  uint8_t count = _count[track];
+  uint8_t k = _segment[track];
+  uint16_t n;
+  do {
+    k = k + 1 == count ? 0 : k + 1;
+    if (!_loop[track] && k + 1 >= count) {
+      _keys[track] = nullptr;
+      return false;
+    }
+    n = _keys[track][k].ticks;
+  } while (!n && k != _segment[track]);
+  if (!n) { // a loop of zero length does not move
+    _keys[track] = nullptr;
+    return false;
+  }
+  _segment[track] = k;
+
+  int64_t p0 = (int64_t)key(track, k) << 32;
+  int64_t p1 = (int64_t)key(track, k + 1) << 32;
+  int64_t m0 = tangent(track, k), m1 = tangent(track, k + 1);
+  int64_t a, b;
+  uint32_t a_lo, b_lo;
+  divideWide(2 * (p0 - p1) + (m0 + m1) * n, (uint64_t)n * n * n, a, a_lo);
+  divideWide(3 * (p1 - p0) - (2 * m0 + m1) * n, (uint64_t)n * n, b, b_lo);
+  _value[track] = p0;
+  // d3 = 6 A, d2 = 6 A + 2 B, d1 = A + B + m0
+  int64_t hi = a;
+  uint32_t lo = a_lo;
+  scale(hi, lo, 6);
+  _d3[track] = hi;
+  _d3_lo[track] = lo;
+  int64_t b2 = b;
+  uint32_t b2_lo = b_lo;
+  scale(b2, b2_lo, 2);
+  add(hi, lo, b2, b2_lo);
+  _d2[track] = hi;
+  _d2_lo[track] = lo;
+  hi = a;
+  lo = a_lo;
+  add(hi, lo, b, b_lo);
+  add(hi, lo, m0, 0);
+  _d1[track] = hi;
+  _d1_lo[track] = lo;
+  _left[track] = n;
+  return true;
+}
+#endif
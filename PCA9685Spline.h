@@ -0,0 +1,79 @@
+/*!
+ *  @file PCA9685Spline.h
+ *
+ *  Fixed-point keyframe splines evaluated by forward differencing into the
+ *  shadow of a PCA9685Fleet.
+ *
+ *  BSD license, all text above must be included in any redistribution
+ */
+#ifndef _PCA9685_SPLINE_H
+#define _PCA9685_SPLINE_H
+
+#include "PCA9685Fleet.h"
+
+#ifndef PCA9685_SPLINE_MAX_TRACKS
+#define PCA9685_SPLINE_MAX_TRACKS 16 /**< channels one spline set can drive */
+#endif
+
+/*!
+ *  @brief  One point of a channel's path
+ */
+struct PCA9685Keyframe {
+  uint16_t value; /**< OFF count (ON = 0) at this keyframe, 0 to 4095 */
+  uint16_t ticks; /**< ticks to the next keyframe */
+};
+
+/*!
+ *  @brief  Moves fleet channels smoothly through keyframes.
+ *
+ *  Each track follows a Catmull-Rom spline: a cubic Hermite segment between
+ *  each pair of keyframes, with the tangent at a keyframe taken from its
+ *  neighbours and scaled by the segment durations, so velocity is continuous
+ *  even when the keyframes are unevenly spaced. A path that does not loop
+ *  starts and ends at rest.
+ *
+ *  Segments are set up once and then advanced by forward differencing: the
+ *  value is kept in 32.32 fixed point and its differences carry 32 more
+ *  fraction bits, so a tick costs three 96-bit adds per track before the
+ *  value goes to PCA9685Fleet::setPWM(), and segments of up to 65535 ticks
+ *  stay within a count of the exact curve. Every segment ends exactly on
+ *  its keyframe, so rounding never accumulates along a path. The keyframe
+ *  arrays are not copied and must outlive the track.
+ */
+class PCA9685Spline {
+public:
+  PCA9685Spline(PCA9685Fleet &fleet);
+  int attach(uint16_t channel, const PCA9685Keyframe *keys, uint8_t count,
+             bool loop = false);
+  void detach(uint8_t track);
+  /*!
+   *  @brief  Whether a track is still moving
+   *  @param  track Index returned by attach()
+   *  @return false once a path that does not loop reached its last keyframe
+   */
+  bool active(uint8_t track) const { return _keys[track] != nullptr; }
+  void tick();
+
+private:
+  bool begin(uint8_t track);
+  int64_t tangent(uint8_t track, uint8_t key);
+  uint16_t key(uint8_t track, uint8_t k) const;
+
+  PCA9685Fleet *_fleet;
+  alignas(PCA9685_CACHE_LINE) int64_t _value[PCA9685_SPLINE_MAX_TRACKS];
+  alignas(PCA9685_CACHE_LINE) int64_t _d1[PCA9685_SPLINE_MAX_TRACKS];
+  alignas(PCA9685_CACHE_LINE) int64_t _d2[PCA9685_SPLINE_MAX_TRACKS];
+  alignas(PCA9685_CACHE_LINE) int64_t _d3[PCA9685_SPLINE_MAX_TRACKS];
+  uint32_t _d1_lo[PCA9685_SPLINE_MAX_TRACKS]; // extra fraction bits of _d1
+  uint32_t _d2_lo[PCA9685_SPLINE_MAX_TRACKS];
+  uint32_t _d3_lo[PCA9685_SPLINE_MAX_TRACKS];
+  uint16_t _left[PCA9685_SPLINE_MAX_TRACKS]; // ticks left in the segment
+  uint16_t _channel[PCA9685_SPLINE_MAX_TRACKS];
+  const PCA9685Keyframe *_keys[PCA9685_SPLINE_MAX_TRACKS]; // null if free
+  uint8_t _count[PCA9685_SPLINE_MAX_TRACKS];
+  uint8_t _segment[PCA9685_SPLINE_MAX_TRACKS]; // keyframe the segment starts at
+  bool _loop[PCA9685_SPLINE_MAX_TRACKS];
+  bool _start[PCA9685_SPLINE_MAX_TRACKS]; // next tick shows keyframe 0
+};
+
+#endif
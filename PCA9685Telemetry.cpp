@@ -0,0 +1,109 @@
+/*!
+ *  @file PCA9685Telemetry.cpp
+ *
+ *  BSD license, all text above must be included in any redistribution
+ */
+
+#include "mbed_PWMServoDriver.h"
+#if PCA9685_ENABLE_TELEMETRY
+#include "PCA9685Telemetry.h"
+
+/* longest record: 5 byte timestamp, chip, channel, two 3 byte values */
+#define TELEMETRY_MAX_RECORD 13
+
+static uint8_t *putVarint(uint8_t *p, uint32_t v) {
+  while (v >= 0x80) {
+    *p++ = (uint8_t)(v | 0x80);
+    v >>= 7;
+  }
+  *p++ = (uint8_t)v;
+  return p;
+}
+
+static uint32_t zigzag(int32_t v) { return ((uint32_t)v << 1) ^ (v >> 31); }
+
+/*!
+ *  @brief  Instantiates a recorder over caller-provided storage
+ *  @param  buffer Storage for the encoded stream
+ *  @param  size   Size of buffer in bytes
+ */
+PCA9685Telemetry::PCA9685Telemetry(uint8_t *buffer, size_t size)
+    : _buf(buffer), _size(size), _dropped(0) {
+  _header[0] = PCA9685_TELEMETRY_MAGIC0;
+  _header[1] = PCA9685_TELEMETRY_MAGIC1;
+  clear();
+}
+
+/*!
+ *  @brief  Appends one setpoint change
+ *  @param  chip    7-bit I2C address of the chip
+ *  @param  channel Output pin, from 0 to 15
+ *  @param  on      ON tick that was sent
+ *  @param  off     OFF tick that was sent
+ */
+void PCA9685Telemetry::record(uint8_t chip, uint8_t channel, uint16_t on,
+                              uint16_t off) {
+  uint32_t now = us_ticker_read();
+  _mutex.lock();
+  if (_sent || _size - _len < TELEMETRY_MAX_RECORD) {
+    _dropped++;
+  } else {
+    uint8_t *p = _buf + _len;
+    p = putVarint(p, now - _last_us);
+    *p++ = chip;
+    *p++ = channel;
+    p = putVarint(p, zigzag((int32_t)on - _last_on));
+    p = putVarint(p, zigzag((int32_t)off - _last_off));
+    _len = p - _buf;
+    _last_us = now;
+    _last_on = on;
+    _last_off = off;
+  }
+  _mutex.unlock();
+}
+
+/*!
+ *  @brief  Writes the recorded stream as one framed block ('P', 'T',
+ * varint(length), records), retrying short writes, and clears the buffer
+ * once the whole block is out. If out fails first (e.g. -EAGAIN on a
+ * non-blocking port), the block is kept and the next drain() writes the
+ * rest of it before anything else.
+ *  @param  out File, serial port or block device file to write to
+ *  @return Bytes written by this call, or a negative error code from out
+ */
+ssize_t PCA9685Telemetry::drain(FileHandle &out) {
+  _mutex.lock();
+  if (!_sent)
+    _hlen = putVarint(_header + 2, _len) - _header;
+  size_t total = _hlen + _len, start = _sent;
+  ssize_t error = 0;
+  while (_sent < total) {
+    ssize_t n = _sent < _hlen ? out.write(_header + _sent, _hlen - _sent)
+                              : out.write(_buf + _sent - _hlen, total - _sent);
+    if (n <= 0) {
+      error = n ? n : -EIO;
+      break;
+    }
+    _sent += n;
+  }
+  ssize_t written = error ? error : (ssize_t)(total - start);
+  if (!error)
+    clear();
+  _mutex.unlock();
+  return written;
+}
+
+/*!
+ *  @brief  Discards the recorded stream, and what drain() had left of a
+ * block; the next record is absolute
+ */
+void PCA9685Telemetry::clear() {
+  _mutex.lock();
+  _len = 0;
+  _sent = 0;
+  _last_us = 0;
+  _last_on = 0;
+  _last_off = 0;
+  _mutex.unlock();
+}
+#endif
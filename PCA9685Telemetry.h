@@ -0,0 +1,53 @@
+/*!
+ *  @file PCA9685Telemetry.h
+ *
+ *  Compact recorder of the setpoints PCA9685 chips acknowledged, for offline
+ *  analysis with tools/telemetry_decode.py.
+ *
+ *  BSD license, all text above must be included in any redistribution
+ */
+#ifndef _PCA9685_TELEMETRY_H
+#define _PCA9685_TELEMETRY_H
+
+#include <mbed.h>
+
+#define PCA9685_TELEMETRY_MAGIC0 'P' /**< First byte of a drained block */
+#define PCA9685_TELEMETRY_MAGIC1 'T' /**< Second byte of a drained block */
+
+/*!
+ *  @brief  Records setpoint changes as a delta-encoded, varint-packed stream.
+ *
+ *  Each record is varint(dt_us), chip, channel, varint(zigzag(d_on)),
+ *  varint(zigzag(d_off)) where the deltas are against the previous record.
+ *  The first record after clear() or drain() carries the absolute timestamp
+ *  and values. Records that do not fit are counted in dropped().
+ *
+ *  drain() writes a block as a whole: when the output fails part way, the
+ *  rest of the block is written by the next drain(), and records arriving
+ *  meanwhile are dropped, so the stream stays decodable.
+ */
+class PCA9685Telemetry {
+public:
+  PCA9685Telemetry(uint8_t *buffer, size_t size);
+  void record(uint8_t chip, uint8_t channel, uint16_t on, uint16_t off);
+  ssize_t drain(FileHandle &out);
+  void clear();
+  size_t size() const { return _len; }
+  const uint8_t *data() const { return _buf; }
+  uint32_t dropped() const { return _dropped; }
+
+private:
+  uint8_t *_buf;
+  size_t _size;
+  size_t _len;
+  uint32_t _dropped;
+  uint32_t _last_us;
+  uint16_t _last_on;
+  uint16_t _last_off;
+  uint8_t _header[7]; // magic and varint(length) of the block being drained
+  uint8_t _hlen;
+  size_t _sent; // bytes of that block already written, 0 if none
+  PlatformMutex _mutex;
+};
+
+#endif
@@ -0,0 +1,120 @@
+/*!
+ *  @file PCA9685Watchdog.cpp
+ *
+ *  BSD license, all text above must be included in any redistribution
+ */
+
+#include "mbed_PWMServoDriver.h"
+#if PCA9685_ENABLE_WATCHDOG
+#include "PCA9685Watchdog.h"
+#if PCA9685_ENABLE_FLEET
+#include "PCA9685Fleet.h"
+#endif
+
+/*!
+ *  @brief  Instantiates a watchdog
+ *  @param  deadline Longest time a chip may go without an acknowledged
+ * setpoint
+ *  @param  priority Priority of the watchdog thread
+ */
+PCA9685Watchdog::PCA9685Watchdog(chrono::milliseconds deadline,
+                                 osPriority priority)
+    : _thread(priority), _deadline_us(deadline.count() * 1000),
+      _running(false), _count(0), _trips(0), _last_latency_us(0),
+      _max_latency_us(0) {}
+
+/*!
+ *  @brief  Supervises one more driver; call before start()
+ *  @param  pwm Driver whose failsafe frame is sent on a missed deadline
+ *  @return false if PCA9685_WATCHDOG_MAX_CHIPS drivers are already added
+ */
+bool PCA9685Watchdog::add(mbed_PWMServoDriver &pwm) {
+  if (_count >= PCA9685_WATCHDOG_MAX_CHIPS)
+    return false;
+  _pwm[_count] = &pwm;
+  _tripped[_count] = false;
+  _count++;
+  return true;
+}
+
+#if PCA9685_ENABLE_FLEET
+/*!
+ *  @brief  Supervises one chip of a fleet; call before start()
+ *  @param  fleet Fleet holding the chip
+ *  @param  chip  Index returned by PCA9685Fleet::add(); its frame from
+ * PCA9685Fleet::setFailsafe() is sent on a missed deadline
+ *  @return false if PCA9685_WATCHDOG_MAX_CHIPS chips are already added
+ */
+bool PCA9685Watchdog::add(PCA9685Fleet &fleet, uint8_t chip) {
+  if (_count >= PCA9685_WATCHDOG_MAX_CHIPS)
+    return false;
+  _pwm[_count] = NULL;
+  _fleet[_count] = &fleet;
+  _chip[_count] = chip;
+  _tripped[_count] = false;
+  _count++;
+  return true;
+}
+#endif
+
+/*!
+ *  @brief  Starts the watchdog thread
+ */
+void PCA9685Watchdog::start() {
+  _running = true;
+  _thread.start(callback(this, &PCA9685Watchdog::run));
+}
+
+/*!
+ *  @brief  Stops the watchdog thread, waiting at most one deadline
+ */
+void PCA9685Watchdog::stop() {
+  _running = false;
+  _thread.join();
+}
+
+void PCA9685Watchdog::run() {
+  while (_running) {
+    uint32_t wait = _deadline_us;
+    for (uint8_t i = 0; i < _count; i++) {
+      uint32_t stamp = lastWrite(i);
+      if (_tripped[i]) {
+        if (stamp == _tripped_stamp[i])
+          continue;
+        _tripped[i] = false; // written since the trip, re-arm
+      }
+      uint32_t age = us_ticker_read() - stamp;
+      if (age < _deadline_us) {
+        wait = min(wait, _deadline_us - age);
+        continue;
+      }
+      sendFailsafe(i);
+      _last_latency_us = us_ticker_read() - (stamp + _deadline_us);
+      _max_latency_us = max(_max_latency_us, _last_latency_us);
+      _trips++;
+      _tripped[i] = true;
+      _tripped_stamp[i] = stamp;
+    }
+    // round up so we never wake just before a deadline
+    ThisThread::sleep_for(chrono::milliseconds((wait + 999) / 1000));
+  }
+}
+
+uint32_t PCA9685Watchdog::lastWrite(uint8_t i) {
+#if PCA9685_ENABLE_FLEET
+  if (!_pwm[i])
+    return _fleet[i]->lastWrite(_chip[i]);
+#endif
+  return _pwm[i]->lastWrite();
+}
+
+void PCA9685Watchdog::sendFailsafe(uint8_t i) {
+#if PCA9685_ENABLE_FLEET
+  if (!_pwm[i]) {
+    _fleet[i]->sendFailsafe(_chip[i]);
+    return;
+  }
+#endif
+  _pwm[i]->sendFailsafe();
+}
+#endif
@@ -0,0 +1,71 @@
+/*!
+ *  @file PCA9685Watchdog.h
+ *
+ *  Deadline watchdog that drives PCA9685 chips to a failsafe frame when the
+ *  control thread stops updating them.
+ *
+ *  BSD license, all text above must be included in any redistribution
+ */
+#ifndef _PCA9685_WATCHDOG_H
+#define _PCA9685_WATCHDOG_H
+
+#include "mbed_PWMServoDriver.h"
+#if PCA9685_ENABLE_FLEET
+class PCA9685Fleet;
+#endif
+
+#ifndef PCA9685_WATCHDOG_MAX_CHIPS
+#define PCA9685_WATCHDOG_MAX_CHIPS 8 /**< chips one watchdog can supervise */
+#endif
+
+/*!
+ *  @brief  Sends each supervised chip's failsafe frame once the time since
+ * the chip last acknowledged a setpoint exceeds the deadline.
+ *
+ *  A chip is either an mbed_PWMServoDriver or one chip of a PCA9685Fleet;
+ *  both stamp the time when a write is acknowledged, not when it is queued,
+ *  so a change stuck in an auto-batch or in a fleet shadow that nobody
+ *  flushes still trips the watchdog. The check runs on its own thread, by
+ *  default at osPriorityRealtime, and the failsafe frame is a precomputed
+ *  buffer sent with a single I2C write, so the latency from deadline to
+ *  frame on the wire is bounded by one kernel tick plus one transaction. A
+ *  chip trips once per stall and re-arms on the next acknowledged setpoint.
+ *  The control thread must not stall while holding the I2C bus lock, or the
+ *  failsafe write cannot get through.
+ */
+class PCA9685Watchdog {
+public:
+  PCA9685Watchdog(chrono::milliseconds deadline,
+                  osPriority priority = osPriorityRealtime);
+  bool add(mbed_PWMServoDriver &pwm);
+#if PCA9685_ENABLE_FLEET
+  bool add(PCA9685Fleet &fleet, uint8_t chip);
+#endif
+  void start();
+  void stop();
+  uint32_t trips() const { return _trips; }
+  uint32_t lastLatency() const { return _last_latency_us; }
+  uint32_t maxLatency() const { return _max_latency_us; }
+
+private:
+  void run();
+  uint32_t lastWrite(uint8_t i);
+  void sendFailsafe(uint8_t i);
+
+  Thread _thread;
+  uint32_t _deadline_us;
+  volatile bool _running;
+  uint8_t _count;
+  mbed_PWMServoDriver *_pwm[PCA9685_WATCHDOG_MAX_CHIPS]; // NULL: fleet chip
+#if PCA9685_ENABLE_FLEET
+  PCA9685Fleet *_fleet[PCA9685_WATCHDOG_MAX_CHIPS];
+  uint8_t _chip[PCA9685_WATCHDOG_MAX_CHIPS];
+#endif
+  uint32_t _tripped_stamp[PCA9685_WATCHDOG_MAX_CHIPS];
+  bool _tripped[PCA9685_WATCHDOG_MAX_CHIPS];
+  uint32_t _trips;
+  uint32_t _last_latency_us;
+  uint32_t _max_latency_us;
+};
+
+#endif
@@ -28,6 +28,10 @@
  */
 
 #include "mbed_PWMServoDriver.h" 
+#include "PCA9685Script.h"
+#if PCA9685_ENABLE_TELEMETRY
+#include "PCA9685Telemetry.h"
+#endif
 
 //#define ENABLE_DEBUG_OUTPUT
 
@@ -55,8 +59,39 @@
  */
 mbed_PWMServoDriver::mbed_PWMServoDriver(const uint8_t addr,
                                                  I2C &i2c)
-    : _i2caddr(addr << 1), _i2c(&i2c) {
-      
+    : _i2caddr(addr << 1), _i2c(&i2c), _period_ref_us(0) {
+#if PCA9685_ENABLE_TELEMETRY
+      _telemetry = NULL;
+#endif
+#if PCA9685_ENABLE_WATCHDOG
+      _last_write_us = us_ticker_read();
+      setFailsafe(NULL);
+#endif
+#if PCA9685_ENABLE_SHADOW
+      // power-up register contents
+      static const uint8_t defaults[PCA9685_LED0_ON_L] = {
+          PCA9685_MODE1_DEFAULT, MODE2_OUTDRV, 0xE2, 0xE4, 0xE8, 0xE0};
+      memcpy(_regs, defaults, sizeof(defaults));
+      for (uint8_t num = 0; num < 16; num++) {
+        uint8_t *led = _regs + PCA9685_LED0_ON_L + 4 * num;
+        led[0] = 0;
+        led[1] = 0;
+        led[2] = 0;
+        led[3] = 0x10; // full OFF
+      }
+      _prescale = 0x1E;
+      _prescale_known = false;
+      _nack_streak = 0;
+      _restoring = false;
+      _restores = 0;
+#endif
+#if PCA9685_ENABLE_AUTOBATCH
+      _batch_window = chrono::microseconds(0);
+      _batch_threshold = 1;
+      _batch_dirty = 0;
+      _batch_count = 0;
+      _batch_queue = NULL;
+#endif
     }
 
 /*!
@@ -81,8 +116,9 @@ void mbed_PWMServoDriver::begin(uint8_t prescale) {
  *  @brief  Sends a reset command to the PCA9685 chip over I2C
  */
 void mbed_PWMServoDriver::reset() {
-  write8(PCA9685_MODE1, MODE1_RESTART);
- ThisThread::sleep_for(chrono::milliseconds(10));
+  static const uint8_t script[] = {PCA9685_WRITE(PCA9685_MODE1, MODE1_RESTART),
+                                   PCA9685_WAIT_US(10000), PCA9685_END};
+  run(script, NULL);
 }
 
 /*!
@@ -110,19 +146,20 @@ void mbed_PWMServoDriver::wakeup() {
  *          Configures the prescale value to be used by the external clock
  */
 void mbed_PWMServoDriver::setExtClk(uint8_t prescale) {
-  uint8_t oldmode = read8(PCA9685_MODE1);
-  uint8_t newmode = (oldmode & ~MODE1_RESTART) | MODE1_SLEEP; // sleep
-  write8(PCA9685_MODE1, newmode); // go to sleep, turn off internal oscillator
-
-  // This sets both the SLEEP and EXTCLK bits of the MODE1 register to switch to
-  // use the external clock.
-  write8(PCA9685_MODE1, (newmode |= MODE1_EXTCLK));
-
-  write8(PCA9685_PRESCALE, prescale); // set the prescaler
-
-  ThisThread::sleep_for(chrono::milliseconds(5));
-  // clear the SLEEP bit to start
-  write8(PCA9685_MODE1, (newmode & ~MODE1_SLEEP) | MODE1_RESTART | MODE1_AI);
+  static const uint8_t script[] = {
+      PCA9685_LOAD(PCA9685_MODE1),
+      // go to sleep, turn off internal oscillator
+      PCA9685_STORE(PCA9685_MODE1, MODE1_RESTART, MODE1_SLEEP),
+      // This sets both the SLEEP and EXTCLK bits of the MODE1 register to
+      // switch to use the external clock.
+      PCA9685_STORE(PCA9685_MODE1, MODE1_RESTART, MODE1_SLEEP | MODE1_EXTCLK),
+      PCA9685_WRITE_ARG(PCA9685_PRESCALE, 0), // set the prescaler
+      PCA9685_WAIT_US(5000),
+      // clear the SLEEP bit to start
+      PCA9685_STORE(PCA9685_MODE1, MODE1_SLEEP,
+                    MODE1_EXTCLK | MODE1_RESTART | MODE1_AI),
+      PCA9685_END};
+  run(script, &prescale);
 
 #ifdef ENABLE_DEBUG_OUTPUT
   printf("Mode now 0x %i \n",read8(PCA9685_MODE1));
@@ -139,32 +176,31 @@ void mbed_PWMServoDriver::setPWMFreq(float freq) {
   printf("Attempting to set freq %f \n",freq);
   
 #endif
-  // Range output modulation frequency is dependant on oscillator
-  if (freq < 1)
-    freq = 1;
-  if (freq > 3500)
-    freq = 3500; // Datasheet limit is 3052=50MHz/(4*4095)
-
-  float prescaleval = ((_oscillator_freq / (freq * 4095.0)) + 0.5) - 1;
-  if (prescaleval < PCA9685_PRESCALE_MIN)
-    prescaleval = PCA9685_PRESCALE_MIN;
-  if (prescaleval > PCA9685_PRESCALE_MAX)
-    prescaleval = PCA9685_PRESCALE_MAX;
-  uint8_t prescale = (uint8_t)prescaleval;
+  uint8_t prescale = pca9685Prescale(freq, _oscillator_freq);
 
 #ifdef ENABLE_DEBUG_OUTPUT
   printf("Final pre-scale: %i",prescale);
    
 #endif
 
-  uint8_t oldmode = read8(PCA9685_MODE1);
-  uint8_t newmode = (oldmode & ~MODE1_RESTART) | MODE1_SLEEP; // sleep
-  write8(PCA9685_MODE1, newmode);                             // go to sleep
-  write8(PCA9685_PRESCALE, prescale); // set the prescaler
-  write8(PCA9685_MODE1, oldmode);
-  ThisThread::sleep_for(chrono::milliseconds(5));
-  // This sets the MODE1 register to turn on auto increment.
-  write8(PCA9685_MODE1, oldmode | MODE1_RESTART | MODE1_AI);
+  writePrescale(prescale);
+}
+
+/*!
+ *  @brief  Loads a prescale value, putting the chip to sleep while it changes
+ *  @param  prescale Value for the PCA9685_PRESCALE register
+ */
+void mbed_PWMServoDriver::writePrescale(uint8_t prescale) {
+  static const uint8_t script[] = {
+      PCA9685_LOAD(PCA9685_MODE1),
+      PCA9685_STORE(PCA9685_MODE1, MODE1_RESTART, MODE1_SLEEP), // go to sleep
+      PCA9685_WRITE_ARG(PCA9685_PRESCALE, 0), // set the prescaler
+      PCA9685_STORE(PCA9685_MODE1, 0, 0),
+      PCA9685_WAIT_US(5000),
+      // This sets the MODE1 register to turn on auto increment.
+      PCA9685_STORE(PCA9685_MODE1, 0, MODE1_RESTART | MODE1_AI),
+      PCA9685_END};
+  run(script, &prescale);
 
 #ifdef ENABLE_DEBUG_OUTPUT
   printf("Mode now 0x %i \n",read8(PCA9685_MODE1));
@@ -201,7 +237,14 @@ void mbed_PWMServoDriver::setOutputMode(bool totempole) {
  *  @return prescale value
  */
 uint8_t mbed_PWMServoDriver::readPrescale(void) {
-  return read8(PCA9685_PRESCALE);
+  uint8_t prescale = read8(PCA9685_PRESCALE);
+#if PCA9685_ENABLE_SHADOW
+  if (prescale) { // 0 if the chip did not answer, it never holds less than 3
+    _prescale = prescale;
+    _prescale_known = true;
+  }
+#endif
+  return prescale;
 }
 
 /*!
@@ -218,7 +261,9 @@ return read8(  PCA9685_LED0_ON_L + 4 * num );
 
 /*!
  *  @brief  Sets the PWM output of one of the PCA9685 pins
- *  @param  num One of the PWM output pins, from 0 to 15
+ *  @param  num One of the PWM output pins, from 0 to 15; past that it picks
+ * the 4 registers at 6 + 4 * num (61 is ALL_LED), written to the chip
+ * directly and left out of the shadow
  *  @param  on At what point in the 4095-part cycle to turn the PWM output ON
  *  @param  off At what point in the 4095-part cycle to turn the PWM output OFF
  */
@@ -232,9 +277,45 @@ char cmd[5];
     cmd[2] = on >> 8;
     cmd[3] = off;
     cmd[4] = off >> 8; 
-  if (_i2c->write(_i2caddr, cmd, 5),false)
+  // pins past 15 (e.g. 61, the ALL_LED registers) go straight to the chip,
+  // outside the shadow and the batch
+#if PCA9685_ENABLE_AUTOBATCH
+  if (num < 16) {
+    _batch_mutex.lock();
+    memcpy(_regs + (uint8_t)cmd[0], cmd + 1, 4);
+    if (_batch_window.count()) {
+      if (!_batch_dirty)
+        _batch_timeout.attach(
+            callback(this, &mbed_PWMServoDriver::batchExpired), _batch_window);
+      if (!(_batch_dirty & (1 << num)))
+        _batch_count++;
+      _batch_dirty |= 1 << num;
+      if (_batch_count >= _batch_threshold)
+        flush();
+      _batch_mutex.unlock();
+      return;
+    }
+    _batch_mutex.unlock();
+  }
+#elif PCA9685_ENABLE_SHADOW
+  if (num < 16)
+    memcpy(_regs + (uint8_t)cmd[0], cmd + 1, 4);
+#endif
+  bool nack = _i2c->write(_i2caddr, cmd, 5);
+  noteAck(!nack);
+#if PCA9685_ENABLE_TELEMETRY
+  if (_telemetry && !nack)
+    _telemetry->record(_i2caddr >> 1, num, on, off);
+#endif
+#if PCA9685_ENABLE_WATCHDOG
+  if (!nack)
+    _last_write_us = us_ticker_read();
+#endif
+  if (nack)
    {    
+#if PCA9685_ENABLE_ERROR_OUTPUT
         printf("setPWM ERR: No ACK on i2c write pin %i!", num);
+#endif
     };
  //printf("setPWM data:  %s \n ",  cmd); 
 //   _i2c->beginTransmission(_i2caddr);
@@ -284,7 +365,8 @@ void mbed_PWMServoDriver::setPin(uint8_t num, uint16_t val, bool invert) {
 
 /*!
  *  @brief  Sets the PWM output of one of the PCA9685 pins based on the input
- * microseconds, output is not precise
+ * microseconds, rounded to the nearest tick of the calibrated oscillator
+ * (or the period reference); tools/conversion_accuracy.cpp reports the error
  *  @param  num One of the PWM output pins, from 0 to 15
  *  @param  Microseconds The number of Microseconds to turn the PWM output ON
  */
@@ -295,38 +377,61 @@ void mbed_PWMServoDriver::writeMicroseconds(uint8_t num,
    
 #endif
 
-  double pulse = Microseconds;
-  double pulselength;
-  pulselength = 1000000; // 1,000,000 us per second
-
-  // Read prescale
-  uint16_t prescale = readPrescale();
+  uint16_t pulse = microsecondsToTicks(Microseconds);
 
-#ifdef ENABLE_DEBUG_OUTPUT
-  
-  printf("%i PCA9685 chip prescale\n",prescale);
-  
+#ifdef ENABLE_DEBUG_OUTPUT 
+  printf("%i pulse for PWM \n",pulse); 
 #endif
 
-  // Calculate the pulse for PWM based on Equation 1 from the datasheet section
-  // 7.3.5
-  prescale += 1;
-  pulselength *= prescale;
-  pulselength /= _oscillator_freq;
+  setPWM(num, 0, pulse);
+}
 
-#ifdef ENABLE_DEBUG_OUTPUT
- 
-  printf("%f us per bit \n",pulselength);
- 
+/*!
+ *  @brief  Converts a duration to PWM ticks using integer math only, from the
+ * period reference if one is set, else from the calibrated oscillator and the
+ * current prescale, read back from the chip until this object sets or reads it
+ *  @param  us Duration in microseconds
+ *  @return Ticks, rounded to nearest (may exceed 4095 for long durations)
+ */
+uint16_t mbed_PWMServoDriver::microsecondsToTicks(uint32_t us) {
+  if (_period_ref_us)
+    return pca9685UsToTicksRef(us, _period_ref_us);
+#if PCA9685_ENABLE_SHADOW
+  // the chip may have been set up by another object, or before this one
+  if (!_prescale_known)
+    readPrescale();
+  uint8_t prescale = _prescale;
+#else
+  uint8_t prescale = readPrescale();
 #endif
+  return pca9685UsToTicks(us, _oscillator_freq, prescale);
+}
 
-  pulse /= pulselength;
-
-#ifdef ENABLE_DEBUG_OUTPUT 
-  printf("%f pulse for PWM \n",pulse); 
-#endif
+/*!
+ *  @brief  Aligns time conversions to an externally measured PWM period,
+ * e.g. captured from an output with a timer, instead of the oscillator
+ *  @param  period_us Measured period in microseconds, 0 to go back to the
+ * oscillator frequency
+ */
+void mbed_PWMServoDriver::setPeriodReference(uint32_t period_us) {
+  _period_ref_us = period_us;
+}
 
-  setPWM(num, 0, pulse);
+/*!
+ *  @brief  Drives an output high only within a window of the PWM period,
+ * e.g. to line LED strobes up with a camera exposure
+ *  @param  num      One of the PWM output pins, from 0 to 15
+ *  @param  start_us Start of the window, measured from the start of the
+ * period; windows running past the end of the period wrap around
+ *  @param  width_us Width of the window; 0 is fully off and a whole period
+ * or more is fully on
+ */
+void mbed_PWMServoDriver::setWindow(uint8_t num, uint32_t start_us,
+                                    uint32_t width_us) {
+  uint16_t on, off;
+  pca9685Window(microsecondsToTicks(start_us), microsecondsToTicks(width_us),
+                &on, &off);
+  setPWM(num, on, off);
 }
 
 /*!
@@ -348,27 +453,266 @@ void mbed_PWMServoDriver::setOscillatorFrequency(uint32_t freq) {
   _oscillator_freq = freq;
 }
 
+#if PCA9685_ENABLE_TELEMETRY
+/*!
+ *  @brief  Records every setpoint of setPWM() and its helpers once the chip
+ * acknowledged it; with auto-batching that is when flush() sends it
+ *  @param  telemetry Recorder to append to, or NULL to stop recording
+ */
+void mbed_PWMServoDriver::setTelemetry(PCA9685Telemetry *telemetry) {
+  _telemetry = telemetry;
+}
+#endif
+
+#if PCA9685_ENABLE_WATCHDOG
+/*!
+ *  @brief  Precomputes the frame sent by sendFailsafe()
+ *  @param  off OFF tick for each of the 16 pins (ON tick 0), a value of 4096
+ * meaning fully off; NULL selects all pins fully off via ALL_LED
+ */
+void mbed_PWMServoDriver::setFailsafe(const uint16_t *off) {
+  if (!off) {
+    _failsafe[0] = PCA9685_ALLLED_ON_L;
+    _failsafe[1] = 0;
+    _failsafe[2] = 0;
+    _failsafe[3] = 0;
+    _failsafe[4] = 0x10; // full OFF bit
+    _failsafe_len = 5;
+    return;
+  }
+  _failsafe[0] = PCA9685_LED0_ON_L;
+  for (uint8_t num = 0; num < 16; num++) {
+    _failsafe[1 + 4 * num] = 0;
+    _failsafe[2 + 4 * num] = 0;
+    _failsafe[3 + 4 * num] = off[num];
+    _failsafe[4 + 4 * num] = off[num] >> 8;
+  }
+  _failsafe_len = sizeof(_failsafe);
+}
+
+/*!
+ *  @brief  Sends the failsafe frame in a single I2C write. The 16 pin frame
+ * relies on auto increment, which begin() and setPWMFreq() enable.
+ */
+void mbed_PWMServoDriver::sendFailsafe() {
+  _i2c->write(_i2caddr, _failsafe, _failsafe_len);
+}
+#endif
+
+#if PCA9685_ENABLE_AUTOBATCH
+/*!
+ *  @brief  Turns on auto-batching: setPWM() (and so setPin() and
+ * writeMicroseconds()) only updates the register shadow, and the changed
+ * channels are sent as auto-increment bursts once the window has passed
+ * since the first unsent change, or as soon as threshold channels are
+ * pending, whichever comes first. Window flushes run on the shared event
+ * queue (mbed_event_queue()); mbed-os dispatches it from its own thread,
+ * unless events.shared-dispatch-from-application is set, in which case the
+ * application must dispatch it. Needs PCA9685_ENABLE_AUTOBATCH.
+ *  @param  window    Longest time a change may wait, 0 to write through
+ * again (pending changes are flushed first)
+ *  @param  threshold Pending channel count that flushes immediately
+ */
+void mbed_PWMServoDriver::setAutoBatch(chrono::microseconds window,
+                                       uint8_t threshold) {
+  _batch_mutex.lock();
+  flush();
+  // the queue and its thread are created on first use, which is not
+  // allowed from the Timeout's interrupt context
+  if (window.count() && !_batch_queue)
+    _batch_queue = mbed_event_queue();
+  _batch_window = window;
+  _batch_threshold = threshold ? threshold : 1;
+  _batch_mutex.unlock();
+}
+
+/*!
+ *  @brief  Sends the channels changed since the last flush; runs of changed
+ * channels go out as single bursts
+ */
+void mbed_PWMServoDriver::flush() {
+  _batch_mutex.lock();
+  _batch_timeout.detach();
+  uint16_t dirty = _batch_dirty;
+  uint8_t num = 0;
+  while (dirty >> num) {
+    while (!(dirty & (1 << num)))
+      num++;
+    uint8_t first = num, last = num;
+    for (num++; num < 16; num++) {
+      if (dirty & (1 << num))
+        last = num;
+      else if (4 * (num - last) > PCA9685_BURST_OVERHEAD)
+        break;
+    }
+    char cmd[1 + 4 * 16];
+    cmd[0] = PCA9685_LED0_ON_L + 4 * first;
+    memcpy(cmd + 1, _regs + (uint8_t)cmd[0], 4 * (last - first + 1));
+    bool nack = _i2c->write(_i2caddr, cmd, 1 + 4 * (last - first + 1));
+    noteAck(!nack);
+#if PCA9685_ENABLE_WATCHDOG
+    if (!nack)
+      _last_write_us = us_ticker_read();
+#endif
+#if PCA9685_ENABLE_TELEMETRY
+    for (uint8_t c = first; _telemetry && !nack && c <= last; c++) {
+      const uint8_t *led = _regs + PCA9685_LED0_ON_L + 4 * c;
+      if (dirty & (1 << c))
+        _telemetry->record(_i2caddr >> 1, c, led[0] | led[1] << 8,
+                           led[2] | led[3] << 8);
+    }
+#endif
+#if PCA9685_ENABLE_ERROR_OUTPUT
+    if (nack)
+      printf("flush ERR: No ACK on i2c write pins %i-%i!", first, last);
+#endif
+    num = last + 1;
+  }
+  _batch_dirty = 0;
+  _batch_count = 0;
+  _batch_mutex.unlock();
+}
+
+void mbed_PWMServoDriver::batchExpired() {
+  // interrupt context: hand the bus work to a thread
+  _batch_queue->call(callback(this, &mbed_PWMServoDriver::flush));
+}
+#endif
+
+#if PCA9685_ENABLE_SHADOW
+/*!
+ *  @brief  Detects a chip that was reset behind our back (power glitch or
+ * board reseated) by comparing MODE1 with the shadow, and restores it
+ *  @return true if the chip had to be restored
+ */
+bool mbed_PWMServoDriver::checkHealth() {
+  uint8_t mode1 = read8(PCA9685_MODE1);
+  if (_restoring || mode1 != PCA9685_MODE1_DEFAULT ||
+      (_regs[PCA9685_MODE1] & ~MODE1_RESTART) == PCA9685_MODE1_DEFAULT)
+    return false;
+  return restore();
+}
+
+/*!
+ *  @brief  Rewrites the chip's whole configuration and frame from the shadow
+ * in four transactions: MODE1 (asleep, auto increment), PRESCALE, one burst
+ * from MODE2 through LED15, then MODE1 awake with restart
+ *  @return true if every transaction was acknowledged
+ */
+bool mbed_PWMServoDriver::restore() {
+  _restoring = true;
+  uint8_t mode1 = (_regs[PCA9685_MODE1] & ~MODE1_RESTART) | MODE1_AI;
+  char cmd[1 + sizeof(_regs)];
+  bool ok = true;
+
+  cmd[0] = PCA9685_MODE1;
+  cmd[1] = mode1 | MODE1_SLEEP;
+  ok &= !_i2c->write(_i2caddr, cmd, 2);
+  cmd[0] = PCA9685_PRESCALE;
+  cmd[1] = _prescale;
+  ok &= !_i2c->write(_i2caddr, cmd, 2);
+  cmd[0] = PCA9685_MODE2;
+  memcpy(cmd + 1, _regs + PCA9685_MODE2, sizeof(_regs) - PCA9685_MODE2);
+  ok &= !_i2c->write(_i2caddr, cmd, sizeof(_regs));
+  if (!(mode1 & MODE1_SLEEP)) {
+    wait_us(500); // oscillator start-up
+    cmd[0] = PCA9685_MODE1;
+    cmd[1] = mode1 | MODE1_RESTART;
+    ok &= !_i2c->write(_i2caddr, cmd, 2);
+  }
+
+  if (ok)
+    _restores++;
+  _restoring = false;
+  return ok;
+}
+#endif
+
+/*!
+ *  @brief  Tracks NACK streaks; the first ACK after a streak means the chip
+ * came back and may have lost its configuration, so it is restored
+ *  @param  ack true if the last transaction was acknowledged
+ */
+void mbed_PWMServoDriver::noteAck(bool ack) {
+#if PCA9685_ENABLE_SHADOW
+  if (!ack) {
+    if (_nack_streak < 255)
+      _nack_streak++;
+    return;
+  }
+  if (_nack_streak >= PCA9685_HOTPLUG_NACKS && !_restoring) {
+    _nack_streak = 0;
+    checkHealth();
+  }
+  _nack_streak = 0;
+#else
+  (void)ack;
+#endif
+}
+
 /******************* Low level I2C interface */
 
 uint8_t mbed_PWMServoDriver::read8(uint8_t addr) {
-    char data;
+    char data = 0;
     if(_i2c->write(_i2caddr, (char *)&addr, 1, true))
-     
+    {
+#if PCA9685_ENABLE_ERROR_OUTPUT
         printf("I2C ERR: no ack on write before read.\n");
-     
+#endif
+        noteAck(false);
+        return 0;
+    }
     if(_i2c->read(_i2caddr, &data, 1))
-    
+    {
+#if PCA9685_ENABLE_ERROR_OUTPUT
         printf("I2C ERR: no ack on read\n");
-     
+#endif
+        noteAck(false);
+        return 0;
+    }
+    noteAck(true);
     return (uint8_t)data;
 }
 
 void mbed_PWMServoDriver::write8(uint8_t addr, uint8_t d) {
-    char data[] = { addr, d };
-    if(_i2c->write(_i2caddr, data, 2))
+    char data[] = { (char)addr, (char)d };
+#if PCA9685_ENABLE_SHADOW
+    shadow(addr, d);
+#endif
+    bool nack = _i2c->write(_i2caddr, data, 2);
+    noteAck(!nack);
+    if(nack)
     {    
-     
+#if PCA9685_ENABLE_ERROR_OUTPUT
         printf("I2C ERR: No ACK on i2c write!");
-    
+#endif
     }
-}
\ No newline at end of file
+}
+
+/* Runs a register script on this chip, keeping the shadow in step. */
+void mbed_PWMServoDriver::run(const uint8_t *script, const uint8_t *args) {
+#if PCA9685_ENABLE_SHADOW
+    int failed = PCA9685Script(script).run(
+        *_i2c, _i2caddr, args, callback(this, &mbed_PWMServoDriver::shadow));
+#else
+    int failed = PCA9685Script(script).run(*_i2c, _i2caddr, args);
+#endif
+    noteAck(!failed);
+    if(failed)
+    {
+#if PCA9685_ENABLE_ERROR_OUTPUT
+        printf("I2C ERR: script failed at offset %d\n", failed - 1);
+#endif
+    }
+}
+
+#if PCA9685_ENABLE_SHADOW
+void mbed_PWMServoDriver::shadow(uint8_t addr, uint8_t d) {
+    if (addr < sizeof(_regs))
+        _regs[addr] = d;
+    else if (addr == PCA9685_PRESCALE) {
+        _prescale = d;
+        _prescale_known = true;
+    }
+}
+#endif
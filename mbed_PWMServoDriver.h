@@ -24,6 +24,95 @@
 #define _ADAFRUIT_PWMServoDriver_H
 
 #include <mbed.h> 
+#include "PCA9685Math.h"
+
+// FEATURE CONFIGURATION
+// Every optional feature is gated by a PCA9685_ENABLE_* macro that defaults to
+// 1 (test hooks, and auto-batching, which gives every driver a Mutex and a
+// Timeout, default to 0). Override it from the build (mbed_app.json "macros" or a compile
+// definition) to strip the feature from small-flash parts; tools/size_report.py
+// measures the footprint of each of these switches.
+#ifndef PCA9685_ENABLE_ERROR_OUTPUT
+#define PCA9685_ENABLE_ERROR_OUTPUT 1 /**< printf on I2C NACKs */
+#endif
+#ifndef PCA9685_ENABLE_TELEMETRY
+#define PCA9685_ENABLE_TELEMETRY 1 /**< setTelemetry() setpoint recorder */
+#endif
+#ifndef PCA9685_ENABLE_WATCHDOG
+#define PCA9685_ENABLE_WATCHDOG 1 /**< failsafe frame and PCA9685Watchdog */
+#endif
+#ifndef PCA9685_ENABLE_SHADOW
+#define PCA9685_ENABLE_SHADOW 1 /**< register shadow and hot-plug restore */
+#endif
+#ifndef PCA9685_ENABLE_AUTOBATCH
+#define PCA9685_ENABLE_AUTOBATCH 0 /**< setAutoBatch() write coalescing */
+#endif
+#if PCA9685_ENABLE_AUTOBATCH && !PCA9685_ENABLE_SHADOW
+#error "PCA9685_ENABLE_AUTOBATCH needs PCA9685_ENABLE_SHADOW"
+#endif
+#ifndef PCA9685_ENABLE_FLEET
+#define PCA9685_ENABLE_FLEET 1 /**< PCA9685Fleet shadow and burst flushing */
+#endif
+#ifndef PCA9685_ENABLE_SEQLOCK
+#define PCA9685_ENABLE_SEQLOCK 1 /**< lock-free fleet shadow snapshots */
+#endif
+#ifndef PCA9685_ENABLE_STATS
+#define PCA9685_ENABLE_STATS 1 /**< fleet update and traffic counters */
+#endif
+#ifndef PCA9685_ENABLE_CHANNEL_STATS
+/** per-chip and per-channel bus accounting, on whenever the fleet stats are */
+#define PCA9685_ENABLE_CHANNEL_STATS PCA9685_ENABLE_STATS
+#endif
+#if PCA9685_ENABLE_CHANNEL_STATS && !PCA9685_ENABLE_STATS
+#error "PCA9685_ENABLE_CHANNEL_STATS needs PCA9685_ENABLE_STATS"
+#endif
+#ifndef PCA9685_ENABLE_QUARANTINE
+#define PCA9685_ENABLE_QUARANTINE 1 /**< fleet failing-chip quarantine */
+#endif
+#ifndef PCA9685_ENABLE_SCHEDULER
+/** PCA9685Scheduler aligned refresh, on whenever the fleet is */
+#define PCA9685_ENABLE_SCHEDULER PCA9685_ENABLE_FLEET
+#endif
+#if PCA9685_ENABLE_SCHEDULER && !PCA9685_ENABLE_FLEET
+#error "PCA9685_ENABLE_SCHEDULER needs PCA9685_ENABLE_FLEET"
+#endif
+#ifndef PCA9685_ENABLE_GROUPS
+#define PCA9685_ENABLE_GROUPS 1 /**< fleet subaddress broadcast grouping */
+#endif
+#ifndef PCA9685_ENABLE_SOFT_START
+#define PCA9685_ENABLE_SOFT_START 1 /**< PCA9685Fleet::softStart() */
+#endif
+#ifndef PCA9685_ENABLE_GATEWAY
+/** PCA9685Gateway host frame streaming, on whenever the fleet is */
+#define PCA9685_ENABLE_GATEWAY PCA9685_ENABLE_FLEET
+#endif
+#if PCA9685_ENABLE_GATEWAY && !PCA9685_ENABLE_FLEET
+#error "PCA9685_ENABLE_GATEWAY needs PCA9685_ENABLE_FLEET"
+#endif
+#ifndef PCA9685_ENABLE_RENDERER
+/** PCA9685Renderer multi-threaded frame rendering, on whenever the fleet is */
+#define PCA9685_ENABLE_RENDERER PCA9685_ENABLE_FLEET
+#endif
+#if PCA9685_ENABLE_RENDERER && !PCA9685_ENABLE_FLEET
+#error "PCA9685_ENABLE_RENDERER needs PCA9685_ENABLE_FLEET"
+#endif
+#ifndef PCA9685_ENABLE_EFFECTS
+/** PCA9685Effects generators, on whenever the fleet is */
+#define PCA9685_ENABLE_EFFECTS PCA9685_ENABLE_FLEET
+#endif
+#if PCA9685_ENABLE_EFFECTS && !PCA9685_ENABLE_FLEET
+#error "PCA9685_ENABLE_EFFECTS needs PCA9685_ENABLE_FLEET"
+#endif
+#ifndef PCA9685_ENABLE_SPLINE
+/** PCA9685Spline keyframe paths, on whenever the fleet is */
+#define PCA9685_ENABLE_SPLINE PCA9685_ENABLE_FLEET
+#endif
+#if PCA9685_ENABLE_SPLINE && !PCA9685_ENABLE_FLEET
+#error "PCA9685_ENABLE_SPLINE needs PCA9685_ENABLE_FLEET"
+#endif
+#ifndef PCA9685_ENABLE_FAULT_INJECTION
+#define PCA9685_ENABLE_FAULT_INJECTION 0 /**< PCA9685Fleet::setFaultHook() */
+#endif
 
 // REGISTER ADDRESSES
 #define PCA9685_MODE1 0x00      /**< Mode Register 1 */
@@ -62,11 +151,58 @@
 #define MODE2_INVRT 0x10  /**< Output logic state inverted */
 
 #define PCA9685_I2C_ADDRESS 0x40      /**< Default PCA9685 I2C Slave Address */
+#define PCA9685_ALLCALL_ADDRESS 0x70  /**< Default LED All Call address */
+#define PCA9685_SUBADR1_ADDRESS 0x71  /**< Default I2C-bus subaddress 1 */
+#define PCA9685_SUBADR2_ADDRESS 0x72  /**< Default I2C-bus subaddress 2 */
+#define PCA9685_SUBADR3_ADDRESS 0x74  /**< Default I2C-bus subaddress 3 */
+#define PCA9685_GENERAL_CALL 0x00     /**< I2C general call address */
+#define PCA9685_SWRST 0x06            /**< general call software reset */
 #define FREQUENCY_OSCILLATOR 25000000 /**< Int. osc. frequency in datasheet */
 
 #define PCA9685_PRESCALE_MIN 3   /**< minimum prescale value */
 #define PCA9685_PRESCALE_MAX 255 /**< maximum prescale value */
 
+#define PCA9685_MODE1_DEFAULT 0x11 /**< MODE1 after power-up or reset */
+#define PCA9685_HOTPLUG_NACKS 3 /**< NACKs before an ACK counts as re-plug */
+/** bus cost of starting another transaction, in data-byte equivalents */
+#define PCA9685_BURST_OVERHEAD 4
+
+class PCA9685Telemetry;
+
+/*!
+ *  @brief  Compile-time prescale for a fixed PWM frequency, rounded the same
+ * way as setPWMFreq(float)
+ *  @tparam FREQ PWM frequency in Hz
+ *  @tparam OSC  Oscillator frequency in Hz
+ */
+template <uint32_t FREQ, uint32_t OSC = FREQUENCY_OSCILLATOR>
+struct PCA9685Prescale {
+  static_assert(FREQ > 0, "PWM frequency must be non-zero");
+  /** prescale + 1, before range checking (0 when FREQ is far too high) */
+  static constexpr uint64_t divider =
+      (OSC + (uint64_t)FREQ * 4095 / 2) / ((uint64_t)FREQ * 4095);
+  static_assert(divider >= PCA9685_PRESCALE_MIN + 1,
+                "PWM frequency too high for this oscillator");
+  static_assert(divider <= PCA9685_PRESCALE_MAX + 1,
+                "PWM frequency too low for this oscillator");
+  /** value to write to PCA9685_PRESCALE */
+  static constexpr uint8_t value = (uint8_t)(divider - 1);
+};
+
+/*!
+ *  @brief  Converts a pulse width to PWM ticks at compile time (when given a
+ * constant) for a fixed frequency and oscillator
+ *  @tparam FREQ PWM frequency in Hz
+ *  @tparam OSC  Oscillator frequency in Hz
+ *  @param  us Pulse width in microseconds
+ *  @return Ticks out of 4096, rounded to nearest and saturated at 65535 like
+ * pca9685UsToTicks()
+ */
+template <uint32_t FREQ, uint32_t OSC = FREQUENCY_OSCILLATOR>
+constexpr uint16_t usToTicks(uint32_t us) {
+  return pca9685UsToTicks(us, OSC, PCA9685Prescale<FREQ, OSC>::value);
+}
+
 /*!
  *  @brief  Class that stores state and functions for interacting with PCA9685
  * PWM chip
@@ -77,25 +213,106 @@ public:
    mbed_PWMServoDriver(const uint8_t addr);
   mbed_PWMServoDriver(const uint8_t addr, I2C &i2c);
   void begin(uint8_t prescale = 0);
+  /*!
+   *  @brief  Like begin(), but sets a fixed PWM frequency whose prescale is
+   * computed at compile time, e.g. begin<50>(), so no frequency math is
+   * linked in
+   */
+  template <uint32_t FREQ, uint32_t OSC = FREQUENCY_OSCILLATOR> void begin() {
+    setOscillatorFrequency(OSC);
+    reset();
+    setPWMFreq<FREQ, OSC>();
+  }
   void reset();
   void sleep();
   void wakeup();
   void setExtClk(uint8_t prescale);
   void setPWMFreq(float freq);
+  /*!
+   *  @brief  Sets a fixed PWM frequency with the prescale computed at compile
+   * time, e.g. setPWMFreq<50>()
+   */
+  template <uint32_t FREQ, uint32_t OSC = FREQUENCY_OSCILLATOR>
+  void setPWMFreq() {
+    writePrescale(PCA9685Prescale<FREQ, OSC>::value);
+  }
   void setOutputMode(bool totempole);
   uint8_t getPWM(uint8_t num);
   void setPWM(uint8_t num, uint16_t on, uint16_t off);
   void setPin(uint8_t num, uint16_t val, bool invert = false);
   uint8_t readPrescale(void);
   void writeMicroseconds(uint8_t num, uint16_t Microseconds);
+  uint16_t microsecondsToTicks(uint32_t us);
+  void setPeriodReference(uint32_t period_us);
+  void setWindow(uint8_t num, uint32_t start_us, uint32_t width_us);
 
   void setOscillatorFrequency(uint32_t freq);
   uint32_t getOscillatorFrequency(void);
 
+#if PCA9685_ENABLE_TELEMETRY
+  void setTelemetry(PCA9685Telemetry *telemetry);
+#endif
+#if PCA9685_ENABLE_WATCHDOG
+  void setFailsafe(const uint16_t *off);
+  void sendFailsafe();
+  /*!
+   *  @brief  Time the chip last acknowledged a setPWM() write or an
+   * auto-batch burst
+   *  @return us_ticker_read() timestamp in microseconds
+   */
+  uint32_t lastWrite() const { return _last_write_us; }
+#endif
+#if PCA9685_ENABLE_SHADOW
+  bool checkHealth();
+  bool restore();
+  /*!
+   *  @brief  Number of times the chip was found reset and restored
+   *  @return restore count
+   */
+  uint32_t restores() const { return _restores; }
+#endif
+#if PCA9685_ENABLE_AUTOBATCH
+  void setAutoBatch(chrono::microseconds window, uint8_t threshold = 16);
+  void flush();
+#endif
+
 private:
   uint8_t _i2caddr;
   I2C *_i2c; 
   uint32_t _oscillator_freq;
+  uint32_t _period_ref_us;
+#if PCA9685_ENABLE_TELEMETRY
+  PCA9685Telemetry *_telemetry;
+#endif
+#if PCA9685_ENABLE_WATCHDOG
+  volatile uint32_t _last_write_us;
+  char _failsafe[1 + 4 * 16];
+  uint8_t _failsafe_len;
+#endif
+#if PCA9685_ENABLE_SHADOW
+  uint8_t _regs[PCA9685_LED0_ON_L + 4 * 16]; // MODE1 up to LED15_OFF_H
+  uint8_t _prescale;
+  bool _prescale_known; // written or read back by this object
+  uint8_t _nack_streak;
+  bool _restoring;
+  uint32_t _restores;
+#endif
+#if PCA9685_ENABLE_AUTOBATCH
+  Mutex _batch_mutex;
+  Timeout _batch_timeout;
+  chrono::microseconds _batch_window;
+  uint8_t _batch_threshold;
+  uint8_t _batch_count;
+  uint16_t _batch_dirty;
+  EventQueue *_batch_queue; // fetched in thread context by setAutoBatch()
+  void batchExpired();
+#endif
+  void writePrescale(uint8_t prescale);
+  void run(const uint8_t *script, const uint8_t *args);
+#if PCA9685_ENABLE_SHADOW
+  void shadow(uint8_t addr, uint8_t d);
+#endif
+  void noteAck(bool ack);
   uint8_t read8(uint8_t addr);
   void write8(uint8_t addr, uint8_t d);
 };
@@ -0,0 +1,132 @@
+/*!
+ *  @file conversion_accuracy.cpp
+ *
+ *  Host benchmark of the time conversions in PCA9685Math.h. Sweeps pulse
+ *  widths, PWM frequencies and oscillator calibrations through every
+ *  conversion path and reports the max and mean error against the ideal,
+ *  in ticks and in microseconds of output pulse. The integer microsecond
+ *  path is checked against the double-precision, truncating conversion
+ *  writeMicroseconds() used to do, and the program fails if it is less
+ *  accurate.
+ *
+ *    c++ -std=c++14 -O2 -I. tools/conversion_accuracy.cpp -o accuracy
+ *    ./accuracy
+ *
+ *  BSD license, all text above must be included in any redistribution
+ */
+
+#include "PCA9685Math.h"
+
+#include <math.h>
+#include <stdio.h>
+
+static const float FREQUENCIES[] = {24, 50, 60, 100, 200, 333, 400, 1000, 1526};
+static const uint32_t OSC_MIN = 23000000, OSC_MAX = 27000000,
+                      OSC_STEP = 250000;
+
+struct Error {
+  const char *path;
+  double max_ticks, sum_ticks, max_us, sum_us;
+  unsigned long samples;
+
+  Error(const char *name)
+      : path(name), max_ticks(0), sum_ticks(0), max_us(0), sum_us(0),
+        samples(0) {}
+
+  void add(double ticks, double us_per_tick) {
+    ticks = fabs(ticks);
+    max_ticks = fmax(max_ticks, ticks);
+    max_us = fmax(max_us, ticks * us_per_tick);
+    sum_ticks += ticks;
+    sum_us += ticks * us_per_tick;
+    samples++;
+  }
+  void print() const {
+    printf("%-22s %9.4f %9.4f %9.3f %9.3f %10lu\n", path, max_ticks,
+           sum_ticks / samples, max_us, sum_us / samples, samples);
+  }
+};
+
+/* writeMicroseconds() before it used pca9685UsToTicks(): double math,
+ * truncated by the conversion to uint16_t. */
+static uint16_t legacyUsToTicks(uint16_t us, uint32_t osc, uint8_t prescale) {
+  double pulselength = 1000000.0 * (prescale + 1) / osc;
+  return (uint16_t)(us / pulselength);
+}
+
+/* Wrapped distance between two tick positions on the 4096 tick circle. */
+static double circular(double a, double b) {
+  double d = fmod(a - b, 4096.0);
+  if (d > 2048)
+    d -= 4096;
+  if (d < -2048)
+    d += 4096;
+  return d;
+}
+
+int main() {
+  Error legacy("us, double (old)"), integer("us, integer"),
+      reference("us, period reference"), angle("angle via us"),
+      window("window edges"), frequency("frequency (% error)");
+
+  for (float freq : FREQUENCIES) {
+    for (uint32_t osc = OSC_MIN; osc <= OSC_MAX; osc += OSC_STEP) {
+      uint8_t prescale = pca9685Prescale(freq, osc);
+      double us_per_tick = 1e6 * (prescale + 1) / osc;
+      double period_us = 4096 * us_per_tick;
+      // what a timer capture of the output would measure, to the microsecond
+      uint32_t measured = (uint32_t)lround(period_us);
+
+      double actual = osc / (4096.0 * (prescale + 1));
+      frequency.add(100 * (actual - freq) / freq, 1);
+
+      uint32_t last = (uint32_t)fmin(period_us, 65535);
+      for (uint32_t us = 0; us <= last; us++) {
+        double ideal = us / us_per_tick;
+        legacy.add(legacyUsToTicks(us, osc, prescale) - ideal, us_per_tick);
+        integer.add(pca9685UsToTicks(us, osc, prescale) - ideal, us_per_tick);
+        reference.add(pca9685UsToTicksRef(us, measured) - ideal, us_per_tick);
+      }
+
+      // servo sketches map 0..180 degrees onto 500..2500 us
+      if (period_us > 2500) {
+        for (uint32_t tenth = 0; tenth <= 1800; tenth++) {
+          uint32_t us = 500 + (tenth * 2000 + 900) / 1800;
+          double ideal = (500 + tenth * 2000 / 1800.0) / us_per_tick;
+          angle.add(pca9685UsToTicks(us, osc, prescale) - ideal, us_per_tick);
+        }
+      }
+
+      uint32_t step = (uint32_t)(period_us / 64) + 1;
+      for (uint32_t start = 0; start < period_us; start += step) {
+        for (uint32_t width = step; width < period_us; width += step) {
+          uint16_t on, off;
+          pca9685Window(pca9685UsToTicks(start, osc, prescale),
+                        pca9685UsToTicks(width, osc, prescale), &on, &off);
+          if (on == 4096 || off == 4096)
+            continue; // fully on or off: no edges to place
+          window.add(circular(on, start / us_per_tick), us_per_tick);
+          window.add(circular(off, (start + width) / us_per_tick),
+                     us_per_tick);
+        }
+      }
+    }
+  }
+
+  printf("%-22s %9s %9s %9s %9s %10s\n", "path", "max tick", "mean tick",
+         "max us", "mean us", "samples");
+  legacy.print();
+  integer.print();
+  reference.print();
+  angle.print();
+  window.print();
+  printf("%-22s %9.4f %9.4f\n", frequency.path, frequency.max_ticks,
+         frequency.sum_ticks / frequency.samples);
+
+  if (integer.max_ticks > legacy.max_ticks ||
+      integer.sum_ticks > legacy.sum_ticks) {
+    printf("FAIL: integer path less accurate than the double path\n");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,86 @@
+/*!
+ *  @file effects_bench.cpp
+ *
+ *  Host benchmark of the PCA9685Effects generators: CPU time per frame of
+ *  wave, chase, breathe, twinkle and gradient over 16 and 1024 fleet
+ *  channels, with the share of channels each frame actually changed (the
+ *  rest are suppressed by the shadow and stay clean). Only rendering into
+ *  the shadow is timed; nothing is flushed.
+ *
+ *  The program fails if an effect leaves a channel of its range outside
+ *  0..4095 or full on.
+ *
+ *    effects_bench [--frames N]
+ *
+ *  BSD license, all text above must be included in any redistribution
+ */
+
+#include "PCA9685Effects.h"
+#include "pca9685_host.h"
+
+#include <stdio.h>
+
+static const char *const NAMES[] = {"wave", "chase", "breathe", "twinkle",
+                                    "gradient"};
+
+/* Renders frame f of effect e. */
+static void render(PCA9685Effects &effects, int e, uint32_t f,
+                   uint16_t count) {
+  switch (e) {
+  case 0:
+    effects.wave(f * 512, 65536 / count);
+    break;
+  case 1:
+    effects.chase(f * 64, 4 * 256);
+    break;
+  case 2:
+    effects.breathe(f * 256);
+    break;
+  case 3:
+    effects.twinkle(1000, 230);
+    break;
+  default:
+    effects.gradient(f % 4096, 4095 - f % 4096);
+    break;
+  }
+}
+
+int main(int argc, char **argv) {
+  unsigned frames = host::option(argc, argv, "--frames", 20000);
+  static const uint16_t COUNTS[] = {16, 1024};
+
+  I2C i2c(NC, NC);
+  PCA9685Fleet fleet(i2c);
+  // nothing is flushed, so the chips need no models or distinct addresses
+  for (unsigned chip = 0; chip < 64; chip++)
+    fleet.add(host::chipAddress(chip % 60));
+
+  printf("%-9s %8s %12s %10s %10s\n", "effect", "channels", "ns/frame",
+         "ns/ch", "changed");
+  int failed = 0;
+  for (uint16_t count : COUNTS) {
+    for (int e = 0; e < 5; e++) {
+      PCA9685Effects effects(fleet, 0, count);
+      render(effects, e, 0, count); // settle the first frame untimed
+      fleet.resetStats();
+      host::Stopwatch watch;
+      for (uint32_t f = 1; f <= frames; f++)
+        render(effects, e, f, count);
+      double ns = watch.seconds() * 1e9 / frames;
+      PCA9685FleetStats stats = fleet.stats();
+      printf("%-9s %8u %12.0f %10.2f %9.1f%%\n", NAMES[e], count, ns,
+             ns / count,
+             100.0 * (stats.requested - stats.suppressed) / stats.requested);
+      for (uint16_t c = 0; c < count; c++) {
+        uint16_t on, off;
+        fleet.getPWM(c / 16, c % 16, &on, &off);
+        if (on == 4096 ? off != 0 : on || off > 4095) {
+          printf("FAIL: %s left channel %u at %u/%u\n", NAMES[e], c, on, off);
+          failed = 1;
+          break;
+        }
+      }
+    }
+  }
+  return failed;
+}
@@ -0,0 +1,229 @@
+/*!
+ *  @file fault_recovery.cpp
+ *
+ *  Host benchmark of how fast a PCA9685Fleet recovers from bus faults, in
+ *  virtual time. A frame loop rewrites every channel of a few chips and
+ *  flushes each frame; between stretches of clean frames one chip is hit by
+ *  a fault, either through the fleet's fault hook or by the chip model:
+ *
+ *    addr-nack  a burst of transactions not acknowledged at the address
+ *    data-nack  a burst of transactions cut off half way
+ *    hang       bus hangs until the SMBus timeout (PCA9685_FAULT_HANG_US)
+ *    stretch    a storm of clock-stretched transactions (still delivered)
+ *    reset      the chip drops off the bus for a while and comes back in its
+ *               power-on state: asleep, default prescale, outputs off
+ *    grouped    the chips share their frames, so the fleet sends them through
+ *               a subaddress group; the chip leaves the shared frame with a
+ *               burst of NACKs and keeps its own while the others go on
+ *               together, and must not get their frames through a group it
+ *               is still a member of
+ *
+ *  Burst lengths and outage times are random, from --seed. For each fault
+ *  the program reports the time from the fault to the first frame the chip
+ *  shows again (outputs equal to the shadow, awake, right prescale) and the
+ *  frames lost on the way: frames the chip missed plus frame slots the loop
+ *  overran. The retry and recovery policy measured is the fleet's own:
+ *  failed channels stay dirty, a chip that NACKed is checked for a reset
+ *  before the next burst, and one that keeps failing is quarantined and
+ *  probed every PCA9685_REPROBE_US. The program fails if a chip has not
+ *  recovered after --timeout-ms.
+ *
+ *  A reset the chip never NACKs through is invisible to the fleet short of
+ *  verify(), so the reset outage always spans at least one transaction.
+ *
+ *    fault_recovery [--trials N] [--frame-ms N] [--timeout-ms N] [--seed N]
+ *
+ *  BSD license, all text above must be included in any redistribution
+ */
+
+#include "PCA9685Fleet.h"
+#include "pca9685_host.h"
+
+#include <stdio.h>
+
+static const uint8_t CHIPS = 4;
+static const uint8_t PRESCALE = PCA9685Prescale<200>::value;
+
+enum Kind { ADDR_NACK, DATA_NACK, HANG, STRETCH, RESET, GROUPED, KINDS };
+static const char *const NAMES[KINDS] = {"addr-nack", "data-nack", "hang",
+                                         "stretch",   "reset",     "grouped"};
+
+/* Fault hook: applies a fault to a chip's next transactions. */
+struct Injector {
+  uint8_t chip = 0;
+  PCA9685Fault fault = PCA9685_FAULT_NONE;
+  unsigned left = 0;
+
+  PCA9685Fault next(uint8_t c) {
+    if (c != chip || !left)
+      return PCA9685_FAULT_NONE;
+    left--;
+    return fault;
+  }
+};
+
+struct Result {
+  unsigned trials = 0, unrecovered = 0;
+  double recovery_ms = 0, recovery_max_ms = 0;
+  unsigned long lost = 0, lost_max = 0;
+};
+
+static PCA9685Fleet *fleet;
+static I2C *i2c;
+static unsigned frame; // frame number, for the channel values
+
+/* Whether the chip shows what the fleet holds for it. */
+static bool showing(uint8_t chip) {
+  host::PCA9685Model *model = i2c->chip(fleet->address(chip));
+  if (!model->present || !model->awake() || model->regs[0xFE] != PRESCALE)
+    return false;
+  for (uint8_t n = 0; n < 16; n++) {
+    uint16_t on, off, chip_on, chip_off;
+    fleet->getPWM(chip, n, &on, &off);
+    model->led(n, &chip_on, &chip_off);
+    if (on != chip_on || off != chip_off)
+      return false;
+  }
+  return true;
+}
+
+/* Sets every channel to this frame's values and flushes. Shared frames are
+ * the same on every chip but apart, which keeps what it holds. */
+static void render(bool shared = false, int apart = -1) {
+  frame++;
+  for (uint8_t chip = 0; chip < CHIPS; chip++)
+    for (uint8_t n = 0; n < 16 && chip != apart; n++)
+      fleet->setPWM(chip, n, 0,
+                    (frame * 37 + !shared * chip * 16 + n * 251) % 4096);
+  fleet->flush();
+}
+
+int main(int argc, char **argv) {
+  unsigned trials = host::option(argc, argv, "--trials", 50);
+  chrono::milliseconds frame_time(host::option(argc, argv, "--frame-ms", 5));
+  chrono::milliseconds timeout(host::option(argc, argv, "--timeout-ms", 2000));
+  host::Random rng(host::option(argc, argv, "--seed", 1));
+
+  i2c = new I2C(NC, NC);
+  i2c->frequency(400000);
+  for (uint8_t chip = 0; chip < CHIPS; chip++)
+    i2c->attach(host::chipAddress(chip));
+  fleet = new PCA9685Fleet(*i2c);
+  for (uint8_t chip = 0; chip < CHIPS; chip++)
+    fleet->add(host::chipAddress(chip));
+  fleet->reset(PRESCALE);
+  Injector injector;
+  fleet->setFaultHook(callback(&injector, &Injector::next));
+
+  Result results[KINDS];
+  host::Stopwatch watch;
+  Kernel::Clock::time_point due = Kernel::Clock::now();
+  for (unsigned t = 0; t < trials * KINDS; t++) {
+    Kind kind = (Kind)(t % KINDS);
+    uint8_t chip = rng.below(CHIPS);
+    bool shared = kind == GROUPED;
+    for (int i = 0; i < 20; i++) { // clean frames in between
+      due += frame_time;
+      ThisThread::sleep_until(due);
+      render(shared);
+    }
+    due = std::max(due, Kernel::Clock::now()); // start on schedule
+    if (!showing(chip)) {
+      printf("FAIL: chip %u not showing before the %s fault\n", chip,
+             NAMES[kind]);
+      return 1;
+    }
+
+    host::PCA9685Model *model = i2c->chip(fleet->address(chip));
+    Kernel::Clock::time_point outage_end = Kernel::Clock::now();
+    injector.chip = chip;
+    switch (kind) {
+    case ADDR_NACK:
+      injector.fault = PCA9685_FAULT_ADDR_NACK;
+      injector.left = 1 + rng.below(8);
+      break;
+    case DATA_NACK:
+      injector.fault = PCA9685_FAULT_DATA_NACK;
+      injector.left = 1 + rng.below(8);
+      break;
+    case HANG:
+      injector.fault = PCA9685_FAULT_HANG;
+      injector.left = 1 + rng.below(3);
+      break;
+    case STRETCH:
+      injector.fault = PCA9685_FAULT_STRETCH;
+      injector.left = 20 + rng.below(80);
+      break;
+    case RESET:
+      model->present = false;
+      outage_end += frame_time + chrono::milliseconds(1 + rng.below(200));
+      break;
+    default:
+      // the first NACK may go to the MODE1 write taking it out of the group
+      injector.fault = PCA9685_FAULT_ADDR_NACK;
+      injector.left = 2 + rng.below(4);
+      fleet->setPWM(chip, 0, 0, (frame * 37 + 2048) % 4096);
+      break;
+    }
+
+    Kernel::Clock::time_point start = Kernel::Clock::now();
+    unsigned long lost = 0;
+    bool recovered = false;
+    while (Kernel::Clock::now() - start < timeout) {
+      due += frame_time;
+      for (; due < Kernel::Clock::now(); due += frame_time)
+        lost++; // slots overrun by a hang or a stretch storm
+      ThisThread::sleep_until(due);
+      if (!model->present && Kernel::Clock::now() >= outage_end) {
+        model->reset();
+        model->present = true;
+      }
+      render(shared, shared ? chip : -1);
+      if (showing(chip)) {
+        recovered = true;
+        break;
+      }
+      lost++;
+    }
+    injector.left = 0;
+
+    Result &r = results[kind];
+    double ms = chrono::duration<double, std::milli>(Kernel::Clock::now() -
+                                                     start)
+                    .count();
+    r.trials++;
+    if (!recovered) {
+      r.unrecovered++;
+      continue;
+    }
+    r.recovery_ms += ms;
+    r.recovery_max_ms = std::max(r.recovery_max_ms, ms);
+    r.lost += lost;
+    r.lost_max = std::max(r.lost_max, lost);
+  }
+
+  PCA9685FleetStats stats = fleet->stats();
+  printf("%u chips, %lld ms frames, %u trials per fault, %u frames in "
+         "%.2f s wall\n",
+         CHIPS, (long long)frame_time.count(), trials, frame, watch.seconds());
+  printf("%-10s %14s %14s %12s %12s\n", "fault", "recovery ms", "worst ms",
+         "lost frames", "worst lost");
+  int failed = 0;
+  for (int k = 0; k < KINDS; k++) {
+    Result &r = results[k];
+    unsigned ok = r.trials - r.unrecovered;
+    printf("%-10s %14.1f %14.1f %12.1f %12lu\n", NAMES[k],
+           ok ? r.recovery_ms / ok : 0, r.recovery_max_ms,
+           ok ? (double)r.lost / ok : 0, r.lost_max);
+    if (r.unrecovered) {
+      printf("FAIL: %u of %u %s faults not recovered within %lld ms\n",
+             r.unrecovered, r.trials, NAMES[k], (long long)timeout.count());
+      failed = 1;
+    }
+  }
+  printf("fleet: failed %u frames_lost %u recoveries %u (worst %u us) "
+         "quarantines %u reintegrations %u\n",
+         stats.failed, stats.frames_lost, stats.recoveries,
+         stats.recovery_max_us, stats.quarantines, stats.reintegrations);
+  return failed;
+}
@@ -0,0 +1,197 @@
+/*!
+ *  @file fleet_layout_bench.cpp
+ *
+ *  Host benchmark of the PCA9685Fleet structure-of-arrays shadow against
+ *  the per-object layout, one mbed_PWMServoDriver with its own auto-batch
+ *  shadow per chip, at about 1k and 10k channels (32 chips per bus, 2 and
+ *  20 buses). For each layout it times
+ *
+ *    scan    a flush with nothing dirty, i.e. the cost of finding no work
+ *    update  setPWM() on a share of the channels plus the flush that packs
+ *            and sends them, per changed channel
+ *
+ *  Both layouts talk to the same PCA9685 register models, so the model's
+ *  own cost is in both update figures. The program fails if a chip's
+ *  outputs end up different from what was set.
+ *
+ *    fleet_layout_bench [--frames N]
+ *
+ *  BSD license, all text above must be included in any redistribution
+ */
+
+#include "PCA9685Fleet.h"
+#include "mbed_PWMServoDriver.h"
+#include "pca9685_host.h"
+
+#include <stdio.h>
+
+#include <memory>
+#include <vector>
+
+static const unsigned CHIPS_PER_BUS = 32;
+
+struct Change {
+  uint32_t channel;
+  uint16_t off;
+};
+
+/* Frames of random changes to share of the channels, made up front so the
+ * random generator is not timed. */
+static std::vector<std::vector<Change>>
+makeFrames(unsigned channels, unsigned frames, double share, uint32_t seed) {
+  host::Random rng(seed);
+  std::vector<std::vector<Change>> out(frames);
+  unsigned per_frame = (unsigned)(channels * share);
+  for (auto &frame : out)
+    for (unsigned i = 0; i < per_frame; i++)
+      frame.push_back({rng.below(channels), (uint16_t)rng.below(4096)});
+  return out;
+}
+
+/* Layout under test */
+class Layout {
+public:
+  virtual ~Layout() {}
+  virtual const char *name() const = 0;
+  virtual void set(uint32_t channel, uint16_t off) = 0;
+  virtual void flush() = 0;
+  /* Channel value held by the chip model */
+  uint16_t output(uint32_t channel) {
+    uint16_t on, off;
+    buses[channel / (16 * CHIPS_PER_BUS)]
+        ->chip(host::chipAddress(channel / 16 % CHIPS_PER_BUS))
+        ->led(channel % 16, &on, &off);
+    return off;
+  }
+  uint64_t bytes() const {
+    uint64_t total = 0;
+    for (auto &bus : buses)
+      total += bus->bytes();
+    return total;
+  }
+
+protected:
+  explicit Layout(unsigned chips) {
+    for (unsigned c = 0; c < chips; c += CHIPS_PER_BUS) {
+      buses.emplace_back(new I2C(NC, NC));
+      buses.back()->frequency(1000000);
+      for (unsigned i = 0; i < CHIPS_PER_BUS; i++)
+        buses.back()->attach(host::chipAddress(i));
+    }
+  }
+  std::vector<std::unique_ptr<I2C>> buses;
+};
+
+class FleetLayout : public Layout {
+public:
+  explicit FleetLayout(unsigned chips) : Layout(chips) {
+    for (auto &bus : buses) {
+      fleets.emplace_back(new PCA9685Fleet(*bus));
+      for (unsigned i = 0; i < CHIPS_PER_BUS; i++)
+        fleets.back()->add(host::chipAddress(i));
+      fleets.back()->reset(PCA9685Prescale<1000>::value);
+    }
+  }
+  const char *name() const override { return "fleet (SoA)"; }
+  void set(uint32_t channel, uint16_t off) override {
+    fleets[channel / (16 * CHIPS_PER_BUS)]->setPWM(
+        channel / 16 % CHIPS_PER_BUS, channel % 16, 0, off);
+  }
+  void flush() override {
+    for (auto &fleet : fleets)
+      fleet->flush();
+  }
+
+private:
+  std::vector<std::unique_ptr<PCA9685Fleet>> fleets;
+};
+
+class ObjectLayout : public Layout {
+public:
+  explicit ObjectLayout(unsigned chips) : Layout(chips) {
+    for (unsigned c = 0; c < chips; c++) {
+      drivers.emplace_back(new mbed_PWMServoDriver(
+          host::chipAddress(c % CHIPS_PER_BUS), *buses[c / CHIPS_PER_BUS]));
+      drivers.back()->begin<1000>();
+      // a window that never expires: flush() is called for every frame
+      drivers.back()->setAutoBatch(chrono::hours(1), 255);
+    }
+  }
+  const char *name() const override { return "per-object"; }
+  void set(uint32_t channel, uint16_t off) override {
+    drivers[channel / 16]->setPWM(channel % 16, 0, off);
+  }
+  void flush() override {
+    for (auto &driver : drivers)
+      driver->flush();
+  }
+
+private:
+  std::vector<std::unique_ptr<mbed_PWMServoDriver>> drivers;
+};
+
+/* Runs the frames; returns ns per changed channel. */
+static double update(Layout &layout,
+                     const std::vector<std::vector<Change>> &frames) {
+  size_t changes = 0;
+  host::Stopwatch watch;
+  for (auto &frame : frames) {
+    for (auto &c : frame)
+      layout.set(c.channel, c.off);
+    layout.flush();
+    changes += frame.size();
+  }
+  return watch.seconds() * 1e9 / changes;
+}
+
+/* Returns ns per channel of a flush that finds nothing to send. */
+static double scan(Layout &layout, unsigned channels, unsigned frames) {
+  host::Stopwatch watch;
+  for (unsigned f = 0; f < frames; f++)
+    layout.flush();
+  return watch.seconds() * 1e9 / ((double)channels * frames);
+}
+
+int main(int argc, char **argv) {
+  unsigned frames = host::option(argc, argv, "--frames", 200);
+  static const unsigned CHANNELS[] = {1024, 10240};
+  static const double SHARES[] = {1.0, 0.1};
+  int failed = 0;
+
+  printf("%-8s %-12s %10s %14s %14s %12s\n", "channels", "layout",
+         "scan ns/ch", "upd 100% ns/ch", "upd 10% ns/ch", "bus B/frame");
+  for (unsigned channels : CHANNELS) {
+    for (int which = 0; which < 2; which++) {
+      std::unique_ptr<Layout> layout;
+      if (which)
+        layout.reset(new ObjectLayout(channels / 16));
+      else
+        layout.reset(new FleetLayout(channels / 16));
+      double ns[2];
+      uint64_t bytes = 0;
+      std::vector<uint16_t> expect(channels, 4096);
+      for (int s = 0; s < 2; s++) {
+        auto work = makeFrames(channels, frames, SHARES[s], 1 + s);
+        uint64_t before = layout->bytes();
+        ns[s] = update(*layout, work);
+        if (!s)
+          bytes = (layout->bytes() - before) / frames;
+        for (auto &frame : work)
+          for (auto &c : frame)
+            expect[c.channel] = c.off;
+      }
+      double idle = scan(*layout, channels, frames);
+      printf("%-8u %-12s %10.2f %14.1f %14.1f %12llu\n", channels,
+             layout->name(), idle, ns[0], ns[1], (unsigned long long)bytes);
+      for (unsigned c = 0; c < channels; c++) {
+        if (layout->output(c) != expect[c]) {
+          printf("FAIL: %s channel %u holds %u, expected %u\n",
+                 layout->name(), c, layout->output(c), expect[c]);
+          failed = 1;
+          break;
+        }
+      }
+    }
+  }
+  return failed;
+}
@@ -0,0 +1,190 @@
+/*!
+ *  @file gateway_pty_test.cpp
+ *
+ *  End-to-end test of PCA9685Gateway with the real host sender, over a Linux
+ *  pseudo-terminal pair. The program writes a random frame sequence as CSV,
+ *  runs tools/pca9685_stream.py on the pty's slave side and serves the
+ *  master side with a gateway driving a fleet on the host bus model. When
+ *  the sender is done, every chip must hold the last frame, in the fleet
+ *  shadow and in the chip's registers.
+ *
+ *  With --corrupt N about one byte in N the gateway reads is flipped, at
+ *  random (a fixed period can keep hitting the same byte of a resent
+ *  window), so CRC rejection, NAK and go-back-N resending are exercised as
+ *  well. With
+ *  --extra N the sender is told of N chips more than the fleet has, whose
+ *  messages the gateway must refuse without the sender resending them.
+ *
+ *    gateway_pty_test --python PATH --script PATH [--chips N] [--frames N]
+ *                     [--corrupt N] [--extra N] [--seed N]
+ *
+ *  BSD license, all text above must be included in any redistribution
+ */
+
+#include "PCA9685Gateway.h"
+#include "pca9685_host.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <string>
+
+/* Gateway side of the pty, optionally corrupting what it reads */
+class PtyHandle : public FileHandle {
+public:
+  PtyHandle(int fd, unsigned corrupt, host::Random &rng)
+      : _fd(fd), _corrupt(corrupt), _rng(rng) {}
+  ssize_t read(void *buffer, size_t size) override {
+    ssize_t n = ::read(_fd, buffer, size);
+    if (n < 0)
+      return errno == EAGAIN ? -EAGAIN : -errno;
+    for (ssize_t i = 0; _corrupt && i < n; i++)
+      if (_rng.below(_corrupt) == 0) {
+        ((uint8_t *)buffer)[i] ^= 0x55;
+        corrupted++;
+      }
+    return n;
+  }
+  ssize_t write(const void *buffer, size_t size) override {
+    const char *p = (const char *)buffer;
+    size_t left = size;
+    while (left) {
+      ssize_t n = ::write(_fd, p, left);
+      if (n < 0 && errno == EAGAIN) {
+        struct pollfd out = {_fd, POLLOUT, 0};
+        ::poll(&out, 1, 100);
+        continue;
+      }
+      if (n < 0)
+        return -errno;
+      p += n;
+      left -= n;
+    }
+    return size;
+  }
+  unsigned long corrupted = 0;
+
+private:
+  int _fd;
+  unsigned _corrupt;
+  host::Random &_rng;
+};
+
+int main(int argc, char **argv) {
+  const char *python = host::stringOption(argc, argv, "--python");
+  const char *script = host::stringOption(argc, argv, "--script");
+  unsigned chips = host::option(argc, argv, "--chips", 4);
+  unsigned frames = host::option(argc, argv, "--frames", 500);
+  unsigned corrupt = host::option(argc, argv, "--corrupt", 0);
+  unsigned extra = host::option(argc, argv, "--extra", 0);
+  host::Random rng(host::option(argc, argv, "--seed", 1));
+  if (!python || !script || chips < 1 || chips > 60 || extra > 60) {
+    fprintf(stderr, "usage: %s --python PATH --script PATH [--chips N] "
+                    "[--frames N] [--corrupt N] [--extra N] [--seed N]\n",
+            argv[0]);
+    return 2;
+  }
+
+  // frames 2 ms apart; each changes a random share of the channels
+  unsigned channels = 16 * (chips + extra);
+  std::vector<uint16_t> on(channels, 0), off(channels, 0);
+  char csv[] = "/tmp/gateway_pty_XXXXXX.csv";
+  int csv_fd = mkstemps(csv, 4);
+  FILE *f = fdopen(csv_fd, "w");
+  fprintf(f, "t_us,chip,channel,on,off\n");
+  unsigned long updates = 0;
+  for (unsigned k = 0; k < frames; k++) {
+    unsigned changes = 1 + rng.below(k ? channels / 4 : 1);
+    for (unsigned i = 0; i < changes; i++) {
+      unsigned c = rng.below(channels);
+      if (rng.below(4) == 0)
+        on[c] = rng.below(4096);
+      off[c] = rng.below(4097); // 4096 is full off
+      fprintf(f, "%u,%u,%u,%u,%u\n", k * 2000, c / 16, c % 16, on[c], off[c]);
+      updates++;
+    }
+  }
+  fclose(f);
+
+  int master = posix_openpt(O_RDWR | O_NOCTTY);
+  if (master < 0 || grantpt(master) || unlockpt(master)) {
+    perror("posix_openpt");
+    return 1;
+  }
+  std::string slave = ptsname(master);
+  fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+
+  I2C i2c(NC, NC);
+  i2c.frequency(1000000);
+  PCA9685Fleet fleet(i2c);
+  for (unsigned chip = 0; chip < chips; chip++) {
+    i2c.attach(host::chipAddress(chip));
+    fleet.add(host::chipAddress(chip));
+  }
+  fleet.reset(PCA9685Prescale<200>::value);
+  PtyHandle port(master, corrupt, rng);
+  PCA9685Gateway gateway(port, fleet);
+
+  std::string count = std::to_string(chips + extra);
+  pid_t sender = fork();
+  if (!sender) {
+    close(master);
+    execl(python, python, script, slave.c_str(), csv, "--chips", count.c_str(),
+          (char *)NULL);
+    perror(python);
+    _exit(127);
+  }
+
+  host::Stopwatch watch;
+  unsigned long applied = 0;
+  int status = 0;
+  for (;;) {
+    struct pollfd in = {master, POLLIN, 0};
+    ::poll(&in, 1, 20);
+    applied += gateway.poll();
+    if (waitpid(sender, &status, WNOHANG) == sender)
+      break;
+    if (watch.seconds() > 60) {
+      printf("FAIL: sender still running after 60 s\n");
+      kill(sender, SIGKILL);
+      waitpid(sender, &status, 0);
+      break;
+    }
+  }
+  applied += gateway.poll();
+  double seconds = watch.seconds();
+  unlink(csv);
+
+  printf("%u chips, %u frames, %lu channel updates in %.2f s: %lu messages "
+         "applied, %lu bytes corrupted, %u rejected\n",
+         chips, frames, updates, seconds, applied, port.corrupted,
+         (unsigned)gateway.rejected());
+  int failed = 0;
+  if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+    printf("FAIL: sender exited with status %d\n", status);
+    failed = 1;
+  }
+  for (unsigned chip = 0; chip < chips && !failed; chip++) {
+    host::PCA9685Model *model = i2c.chip(fleet.address(chip));
+    for (uint8_t n = 0; n < 16; n++) {
+      uint16_t shadow_on, shadow_off, chip_on, chip_off;
+      fleet.getPWM(chip, n, &shadow_on, &shadow_off);
+      model->led(n, &chip_on, &chip_off);
+      unsigned c = 16 * chip + n;
+      if (shadow_on != on[c] || shadow_off != off[c] || chip_on != on[c] ||
+          chip_off != off[c]) {
+        printf("FAIL: chip %u channel %u: sent %u/%u, shadow %u/%u, chip "
+               "%u/%u\n",
+               chip, n, on[c], off[c], shadow_on, shadow_off, chip_on,
+               chip_off);
+        failed = 1;
+      }
+    }
+  }
+  return failed;
+}
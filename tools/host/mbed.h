@@ -0,0 +1,819 @@
+/*!
+ *  @file mbed.h
+ *
+ *  Host stand-in for the parts of mbed-os the library uses, so the library
+ *  and the programs in tools/ build and run on a PC.
+ *
+ *  Time is virtual. The clock only moves when code waits: wait_us() and
+ *  every I2C transfer (at the bus frequency) advance it, and when every
+ *  thread is blocked in ThisThread::sleep_for(), a Semaphore or thread
+ *  flags, it jumps to the next timer. Hours of run time therefore pass in
+ *  seconds, and a Timeout fires exactly when due, in the thread that moved
+ *  the clock past it (its "interrupt context"). Threads are real
+ *  std::threads, so races between them are real too. Only rtos::Thread
+ *  threads may use the blocking calls.
+ *
+ *  I2C carries a register model of each PCA9685 attached with
+ *  I2C::attach(): auto increment, the ALL_LED registers, the LED All Call
+ *  and subaddress broadcasts and the general call software reset. Tests
+ *  reach into a chip through the returned host::PCA9685Model to glitch it,
+ *  read its outputs or take it off the bus.
+ *
+ *  BSD license, all text above must be included in any redistribution
+ */
+#ifndef _HOST_MBED_H
+#define _HOST_MBED_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+typedef int PinName;
+#define NC ((PinName)-1)
+#define I2C_SDA ((PinName)0)
+#define I2C_SCL ((PinName)1)
+#define USBTX ((PinName)2)
+#define USBRX ((PinName)3)
+
+typedef enum {
+  osPriorityIdle = 1,
+  osPriorityLow = 8,
+  osPriorityBelowNormal = 16,
+  osPriorityNormal = 24,
+  osPriorityAboveNormal = 32,
+  osPriorityHigh = 40,
+  osPriorityRealtime = 48,
+} osPriority_t;
+typedef osPriority_t osPriority;
+typedef int32_t osStatus;
+#define osOK 0
+typedef void *osThreadId_t;
+
+namespace host {
+
+/* A thread as the virtual-time kernel sees it. */
+struct Task {
+  std::condition_variable cv;
+  bool blocked = false;
+  uint32_t flags = 0;
+  uint32_t wait_any = 0; // flags it is blocked on, if any
+  bool done = false;     // thread function returned
+  Task *joiner = nullptr;
+};
+
+typedef std::pair<uint64_t, uint64_t> EventKey; // due time in ns, serial
+
+/* Virtual clock, timer events and the count of threads able to run. */
+class Kernel {
+public:
+  typedef std::unique_lock<std::mutex> Lock;
+
+  static Kernel &get() {
+    static Kernel *kernel = new Kernel; // outlives detached threads
+    return *kernel;
+  }
+
+  static Task *&current() {
+    thread_local Task *task = nullptr;
+    return task;
+  }
+
+  /* The calling thread; threads not started by rtos::Thread are taken for
+   * the main thread. */
+  static Task *self() {
+    static Task *main_task = new Task;
+    Task *&task = current();
+    if (!task)
+      task = main_task;
+    return task;
+  }
+
+  uint64_t now() {
+    Lock l(mutex);
+    return now_ns;
+  }
+
+  /* Schedules fn at time at; lock held. An isr event runs unlocked. */
+  EventKey post(uint64_t at, std::function<void()> fn, bool isr) {
+    EventKey key(at, serial++);
+    events.emplace(key, Event{std::move(fn), isr});
+    return key;
+  }
+
+  /* Schedules fn delay_ns from now. */
+  EventKey schedule(uint64_t delay_ns, std::function<void()> fn, bool isr) {
+    Lock l(mutex);
+    return post(now_ns + delay_ns, std::move(fn), isr);
+  }
+
+  void cancel(EventKey key) {
+    Lock l(mutex);
+    events.erase(key);
+  }
+
+  /* Makes a blocked task runnable; lock held. */
+  void ready(Task *task) {
+    if (!task->blocked)
+      return;
+    task->blocked = false;
+    runnable++;
+    task->cv.notify_one();
+  }
+
+  /* Blocks the calling task until ready() is called on it; lock held. The
+   * last task to block moves the clock on. */
+  void block(Lock &l, Task *task) {
+    task->blocked = true;
+    runnable--;
+    while (task->blocked) {
+      if (runnable == 0)
+        settle(l);
+      else
+        task->cv.wait(l);
+    }
+  }
+
+  /* Fires timer events while no thread can run; lock held. */
+  void settle(Lock &l) {
+    while (runnable == 0) {
+      if (events.empty()) {
+        fprintf(stderr, "host: every thread is blocked and no timer is "
+                        "pending\n");
+        abort();
+      }
+      fire(l);
+    }
+  }
+
+  /* Busy time of the calling thread, e.g. wait_us() or a bus transfer:
+   * moves the clock on, firing the events it passes. */
+  void advance(uint64_t ns) {
+    Lock l(mutex);
+    uint64_t target = now_ns + ns;
+    while (!events.empty() && events.begin()->first.first <= target)
+      fire(l);
+    now_ns = std::max(now_ns, target);
+  }
+
+  void sleepUntil(uint64_t at) {
+    Lock l(mutex);
+    if (at <= now_ns)
+      return;
+    Task *task = self();
+    post(at, [this, task] { ready(task); }, false);
+    block(l, task);
+  }
+
+  void setFlags(Task *task, uint32_t flags) {
+    Lock l(mutex);
+    task->flags |= flags;
+    if (task->wait_any & task->flags)
+      ready(task);
+  }
+
+  uint32_t waitAny(uint32_t flags, bool clear) {
+    Lock l(mutex);
+    Task *task = self();
+    while (!(task->flags & flags)) {
+      task->wait_any = flags;
+      block(l, task);
+    }
+    task->wait_any = 0;
+    uint32_t set = task->flags;
+    if (clear)
+      task->flags &= ~flags;
+    return set;
+  }
+
+  std::mutex mutex;
+  int runnable = 1; // the main thread
+
+private:
+  struct Event {
+    std::function<void()> fn;
+    bool isr;
+  };
+
+  /* Runs the earliest event, moving the clock to it; lock held. */
+  void fire(Lock &l) {
+    auto it = events.begin();
+    now_ns = std::max(now_ns, it->first.first);
+    Event event = std::move(it->second);
+    events.erase(it);
+    if (!event.isr) {
+      event.fn();
+      return;
+    }
+    runnable++; // the interrupt handler runs
+    l.unlock();
+    event.fn();
+    l.lock();
+    runnable--;
+  }
+
+  uint64_t now_ns = 0;
+  uint64_t serial = 1;
+  std::map<EventKey, Event> events;
+};
+
+template <typename D> inline uint64_t ns(D d) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+}
+
+} // namespace host
+
+inline uint32_t us_ticker_read() {
+  return (uint32_t)(host::Kernel::get().now() / 1000);
+}
+inline void wait_us(int us) { host::Kernel::get().advance((uint64_t)us * 1000); }
+inline void wait_ns(unsigned int ns) { host::Kernel::get().advance(ns); }
+
+inline uint32_t osThreadFlagsSet(osThreadId_t thread, uint32_t flags) {
+  host::Kernel::get().setFlags((host::Task *)thread, flags);
+  return flags;
+}
+
+/* Atomics, as mbed_atomic.h has them */
+#define HOST_ATOMIC(T, S)                                                      \
+  inline T core_util_atomic_load_##S(const volatile T *p) {                   \
+    return __atomic_load_n(p, __ATOMIC_SEQ_CST);                              \
+  }                                                                            \
+  inline void core_util_atomic_store_##S(volatile T *p, T v) {                \
+    __atomic_store_n(p, v, __ATOMIC_SEQ_CST);                                 \
+  }                                                                            \
+  inline T core_util_atomic_exchange_##S(volatile T *p, T v) {                \
+    return __atomic_exchange_n(p, v, __ATOMIC_SEQ_CST);                       \
+  }                                                                            \
+  inline bool core_util_atomic_cas_##S(volatile T *p, T *expected, T v) {     \
+    return __atomic_compare_exchange_n(p, expected, v, false,                 \
+                                       __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);   \
+  }                                                                            \
+  inline T core_util_atomic_incr_##S(volatile T *p, T d) {                    \
+    return __atomic_add_fetch(p, d, __ATOMIC_SEQ_CST);                        \
+  }                                                                            \
+  inline T core_util_atomic_decr_##S(volatile T *p, T d) {                    \
+    return __atomic_sub_fetch(p, d, __ATOMIC_SEQ_CST);                        \
+  }                                                                            \
+  inline T core_util_atomic_fetch_add_##S(volatile T *p, T d) {               \
+    return __atomic_fetch_add(p, d, __ATOMIC_SEQ_CST);                        \
+  }                                                                            \
+  inline T core_util_atomic_fetch_or_##S(volatile T *p, T d) {                \
+    return __atomic_fetch_or(p, d, __ATOMIC_SEQ_CST);                         \
+  }                                                                            \
+  inline T core_util_atomic_fetch_and_##S(volatile T *p, T d) {               \
+    return __atomic_fetch_and(p, d, __ATOMIC_SEQ_CST);                        \
+  }
+HOST_ATOMIC(uint8_t, u8)
+HOST_ATOMIC(uint16_t, u16)
+HOST_ATOMIC(uint32_t, u32)
+#undef HOST_ATOMIC
+
+namespace mbed {
+
+template <typename F> class Callback;
+
+/*!
+ *  @brief  Function object like mbed::Callback
+ */
+template <typename R, typename... A> class Callback<R(A...)> {
+public:
+  Callback() {}
+  Callback(std::nullptr_t) {}
+  Callback(R (*fn)(A...)) {
+    if (fn)
+      _fn = fn;
+  }
+  template <typename T, typename U> Callback(U *obj, R (T::*method)(A...)) {
+    _fn = [obj, method](A... a) { return (obj->*method)(a...); };
+  }
+  template <typename T, typename U>
+  Callback(const U *obj, R (T::*method)(A...) const) {
+    _fn = [obj, method](A... a) { return (obj->*method)(a...); };
+  }
+  template <typename F,
+            typename = decltype(std::declval<F &>()(std::declval<A>()...))>
+  Callback(F f) : _fn(f) {}
+  R operator()(A... a) const { return _fn(a...); }
+  R call(A... a) const { return _fn(a...); }
+  explicit operator bool() const { return (bool)_fn; }
+
+private:
+  std::function<R(A...)> _fn;
+};
+
+template <typename T, typename U, typename R, typename... A>
+Callback<R(A...)> callback(U *obj, R (T::*method)(A...)) {
+  return Callback<R(A...)>(obj, method);
+}
+template <typename R, typename... A>
+Callback<R(A...)> callback(R (*fn)(A...)) {
+  return Callback<R(A...)>(fn);
+}
+template <typename R, typename T, typename U>
+Callback<R()> callback(R (*fn)(T *), U *arg) {
+  return Callback<R()>([fn, arg] { return fn(arg); });
+}
+
+/*!
+ *  @brief  One-shot timer; the callback runs in interrupt context
+ */
+class Timeout {
+public:
+  Timeout() {}
+  ~Timeout() { detach(); }
+  template <typename D> void attach(Callback<void()> fn, D delay) {
+    detach();
+    _key = host::Kernel::get().schedule(host::ns(delay), [fn] { fn(); }, true);
+  }
+  void detach() { host::Kernel::get().cancel(_key); }
+
+private:
+  host::EventKey _key; // erasing a fired or unset key does nothing
+};
+
+/*!
+ *  @brief  Stopwatch on the virtual clock
+ */
+class Timer {
+public:
+  void start() {
+    if (!_running)
+      _started = host::Kernel::get().now();
+    _running = true;
+  }
+  void stop() {
+    if (_running)
+      _total += host::Kernel::get().now() - _started;
+    _running = false;
+  }
+  void reset() {
+    _total = 0;
+    _started = host::Kernel::get().now();
+  }
+  std::chrono::microseconds elapsed_time() const {
+    uint64_t t = _total;
+    if (_running)
+      t += host::Kernel::get().now() - _started;
+    return std::chrono::microseconds(t / 1000);
+  }
+
+private:
+  uint64_t _started = 0, _total = 0;
+  bool _running = false;
+};
+
+/*!
+ *  @brief  Byte stream interface like mbed::FileHandle
+ */
+class FileHandle {
+public:
+  virtual ~FileHandle() {}
+  virtual ssize_t read(void *buffer, size_t size) = 0;
+  virtual ssize_t write(const void *buffer, size_t size) = 0;
+  virtual off_t seek(off_t, int) { return -1; }
+  virtual int close() { return 0; }
+  virtual int set_blocking(bool blocking) { return blocking ? 0 : -1; }
+};
+
+/*!
+ *  @brief  Serial port on the process's stdin and stdout
+ */
+class BufferedSerial : public FileHandle {
+public:
+  BufferedSerial(PinName, PinName, int = 9600) {}
+  ssize_t read(void *buffer, size_t size) override {
+    return ::read(0, buffer, size);
+  }
+  ssize_t write(const void *buffer, size_t size) override {
+    return ::write(1, buffer, size);
+  }
+  int set_blocking(bool) override { return 0; }
+};
+
+enum crc_polynomial { POLY_16BIT_CCITT = 0x1021 };
+
+/*!
+ *  @brief  CRC-16/CCITT-FALSE, the only MbedCRC the library uses
+ */
+template <uint32_t POLY, uint32_t WIDTH> class MbedCRC {
+public:
+  int32_t compute(const void *buffer, unsigned long long size,
+                  uint32_t *crc) {
+    const uint8_t *b = (const uint8_t *)buffer;
+    uint16_t c = 0xFFFF;
+    while (size--) {
+      c ^= *b++ << 8;
+      for (int i = 0; i < 8; i++)
+        c = c & 0x8000 ? (c << 1) ^ POLY : c << 1;
+    }
+    *crc = c;
+    return 0;
+  }
+};
+
+} // namespace mbed
+
+namespace host {
+
+/*!
+ *  @brief  Registers of one PCA9685
+ */
+struct PCA9685Model {
+  explicit PCA9685Model(uint8_t address) : addr(address) { reset(); }
+
+  /* Power-on state: asleep, All Call on, every output full off. */
+  void reset() {
+    memset(regs, 0, sizeof(regs));
+    regs[0x00] = 0x11; // MODE1: SLEEP | ALLCALL
+    regs[0x01] = 0x04; // MODE2: OUTDRV
+    regs[0x02] = 0xE2;
+    regs[0x03] = 0xE4;
+    regs[0x04] = 0xE8;
+    regs[0x05] = 0xE0;
+    for (int n = 0; n < 16; n++)
+      regs[0x09 + 4 * n] = 0x10; // LEDn_OFF_H full off
+    regs[0xFE] = 0x1E;
+    ptr = 0;
+  }
+
+  /* Whether the chip answers a broadcast 7-bit address. */
+  bool answers(uint8_t a) const {
+    return ((regs[0] & 0x01) && regs[5] >> 1 == a) ||
+           ((regs[0] & 0x08) && regs[2] >> 1 == a) ||
+           ((regs[0] & 0x04) && regs[3] >> 1 == a) ||
+           ((regs[0] & 0x02) && regs[4] >> 1 == a);
+  }
+
+  bool awake() const { return !(regs[0] & 0x10); }
+
+  void led(uint8_t n, uint16_t *on, uint16_t *off) const {
+    const uint8_t *r = regs + 6 + 4 * n;
+    *on = r[0] | r[1] << 8;
+    *off = r[2] | r[3] << 8;
+  }
+
+  uint8_t addr;       /**< 7-bit address */
+  bool present = true; /**< false: NACKs everything, e.g. unpowered */
+  uint8_t regs[256];
+  uint8_t ptr;
+};
+
+} // namespace host
+
+namespace mbed {
+
+/*!
+ *  @brief  I2C master driving the PCA9685 models attached to it
+ */
+class I2C {
+public:
+  enum Acknowledge { NoACK = 0, ACK = 1 };
+
+  I2C(PinName, PinName) { memset(_chips, 0, sizeof(_chips)); }
+
+  void frequency(int hz) { _hz = hz; }
+
+  int write(int address, const char *data, int length, bool = false) {
+    std::lock_guard<std::recursive_mutex> g(_mutex);
+    busTime(length);
+    uint8_t a = (address >> 1) & 0x7F;
+    if (a == 0) { // general call
+      if (length >= 1 && data[0] == 0x06)
+        for (auto &chip : _all)
+          if (chip->present)
+            chip->reset();
+      return 0;
+    }
+    host::PCA9685Model *chip = _chips[a];
+    if (chip)
+      return chip->present ? store(chip, data, length), 0 : 1;
+    bool acked = false;
+    for (auto &c : _all) {
+      if (c->present && c->answers(a)) {
+        store(c.get(), data, length);
+        acked = true;
+      }
+    }
+    return !acked;
+  }
+
+  int read(int address, char *data, int length, bool = false) {
+    std::lock_guard<std::recursive_mutex> g(_mutex);
+    busTime(length);
+    host::PCA9685Model *chip = _chips[(address >> 1) & 0x7F];
+    if (!chip || !chip->present)
+      return 1;
+    for (int i = 0; i < length; i++) {
+      uint8_t r = chip->ptr;
+      data[i] = r >= 0xFA && r <= 0xFD ? 0 : chip->regs[r];
+      if (chip->regs[0] & 0x20)
+        chip->ptr = r == 0x45 ? 0 : r + 1;
+    }
+    return 0;
+  }
+
+  void start() {}
+  void stop() {}
+  void lock() { _mutex.lock(); }
+  void unlock() { _mutex.unlock(); }
+
+  /*!
+   *  @brief  Puts a PCA9685 on the bus, in its power-on state
+   *  @param  address 7-bit address
+   *  @return the chip's registers
+   */
+  host::PCA9685Model *attach(uint8_t address) {
+    std::lock_guard<std::recursive_mutex> g(_mutex);
+    _all.emplace_back(new host::PCA9685Model(address));
+    _chips[address & 0x7F] = _all.back().get();
+    return _all.back().get();
+  }
+
+  host::PCA9685Model *chip(uint8_t address) { return _chips[address & 0x7F]; }
+
+  /*!
+   *  @brief  Called with the chip's 7-bit address, the channel and its
+   * registers each time a chip latches a channel's OFF_H byte
+   */
+  void observe(std::function<void(uint8_t, uint8_t, uint16_t, uint16_t)> fn) {
+    std::lock_guard<std::recursive_mutex> g(_mutex);
+    _observer = fn;
+  }
+
+  uint64_t bytes() const { return _bytes; }
+  uint64_t transfers() const { return _transfers; }
+
+private:
+  void busTime(int length) {
+    _bytes += 1 + length;
+    _transfers++;
+    // start, address and data bytes with their ACK bits, stop
+    uint64_t bits = 9 * (1 + (uint64_t)length) + 2;
+    host::Kernel::get().advance(bits * 1000000000ull / _hz);
+  }
+
+  void store(host::PCA9685Model *chip, const char *data, int length) {
+    if (length < 1)
+      return;
+    chip->ptr = data[0];
+    for (int i = 1; i < length; i++) {
+      uint8_t r = chip->ptr, v = data[i];
+      if (r >= 0xFA && r <= 0xFD) { // ALL_LED
+        for (int n = 0; n < 16; n++)
+          chip->regs[6 + 4 * n + r - 0xFA] = v;
+        if (r == 0xFD)
+          for (int n = 0; n < 16; n++)
+            notify(chip, n);
+      } else if (r == 0xFE) {
+        if (chip->regs[0] & 0x10) // prescale only takes while asleep
+          chip->regs[r] = v;
+      } else {
+        chip->regs[r] = r == 0 ? v & 0x7F : v; // RESTART clears on write
+        if (r >= 6 && r < 0x46 && (r - 6) % 4 == 3)
+          notify(chip, (r - 6) / 4);
+      }
+      if (chip->regs[0] & 0x20)
+        chip->ptr = r == 0x45 ? 0 : r + 1;
+    }
+  }
+
+  void notify(host::PCA9685Model *chip, int n) {
+    if (!_observer)
+      return;
+    uint16_t on, off;
+    chip->led(n, &on, &off);
+    _observer(chip->addr, n, on, off);
+  }
+
+  std::recursive_mutex _mutex;
+  int _hz = 100000;
+  host::PCA9685Model *_chips[128];
+  std::vector<std::unique_ptr<host::PCA9685Model>> _all;
+  std::function<void(uint8_t, uint8_t, uint16_t, uint16_t)> _observer;
+  uint64_t _bytes = 0, _transfers = 0;
+};
+
+} // namespace mbed
+
+namespace rtos {
+
+/*!
+ *  @brief  Recursive mutex, like rtos::Mutex
+ */
+class Mutex {
+public:
+  void lock() { _mutex.lock(); }
+  void unlock() { _mutex.unlock(); }
+  bool trylock() { return _mutex.try_lock(); }
+
+private:
+  std::recursive_mutex _mutex;
+};
+
+/*!
+ *  @brief  Counting semaphore whose waits let virtual time pass
+ */
+class Semaphore {
+public:
+  explicit Semaphore(int32_t count = 0, uint16_t = 0xFFFF) : _count(count) {}
+  void acquire() {
+    host::Kernel &k = host::Kernel::get();
+    host::Kernel::Lock l(k.mutex);
+    if (_count > 0) {
+      _count--;
+      return;
+    }
+    host::Task *task = host::Kernel::self();
+    _waiters.push_back(task);
+    k.block(l, task); // release() hands its token straight over
+  }
+  bool try_acquire() {
+    host::Kernel::Lock l(host::Kernel::get().mutex);
+    if (_count <= 0)
+      return false;
+    _count--;
+    return true;
+  }
+  osStatus release() {
+    host::Kernel &k = host::Kernel::get();
+    host::Kernel::Lock l(k.mutex);
+    if (_waiters.empty()) {
+      _count++;
+    } else {
+      k.ready(_waiters.front());
+      _waiters.pop_front();
+    }
+    return osOK;
+  }
+
+private:
+  int32_t _count;
+  std::deque<host::Task *> _waiters;
+};
+
+/*!
+ *  @brief  Thread known to the virtual-time kernel. The priority is
+ * ignored: the host schedules threads as it likes.
+ */
+class Thread {
+public:
+  Thread(osPriority = osPriorityNormal, uint32_t = 0, unsigned char * = nullptr,
+         const char * = nullptr) {}
+  ~Thread() {
+    if (_thread.joinable())
+      _thread.detach();
+  }
+  osStatus start(mbed::Callback<void()> task) {
+    host::Kernel &k = host::Kernel::get();
+    {
+      host::Kernel::Lock l(k.mutex);
+      k.runnable++;
+    }
+    _thread = std::thread([this, task] {
+      host::Kernel &k = host::Kernel::get();
+      host::Kernel::current() = &_task;
+      task();
+      host::Kernel::Lock l(k.mutex);
+      _task.done = true;
+      if (_task.joiner)
+        k.ready(_task.joiner);
+      k.runnable--;
+      if (k.runnable == 0)
+        k.settle(l);
+    });
+    return osOK;
+  }
+  osStatus join() {
+    host::Kernel &k = host::Kernel::get();
+    {
+      host::Kernel::Lock l(k.mutex);
+      if (!_task.done) {
+        _task.joiner = host::Kernel::self();
+        k.block(l, _task.joiner);
+      }
+    }
+    if (_thread.joinable())
+      _thread.join();
+    return osOK;
+  }
+  uint32_t flags_set(uint32_t flags) {
+    host::Kernel::get().setFlags(&_task, flags);
+    return flags;
+  }
+  osThreadId_t get_id() const { return (osThreadId_t)&_task; }
+
+private:
+  host::Task _task;
+  std::thread _thread;
+};
+
+namespace Kernel {
+/*!
+ *  @brief  Millisecond clock on the virtual time base
+ */
+struct Clock {
+  typedef std::chrono::duration<int64_t, std::milli> duration;
+  typedef duration::rep rep;
+  typedef duration::period period;
+  typedef std::chrono::time_point<Clock> time_point;
+  static const bool is_steady = true;
+  static time_point now() {
+    return time_point(duration(host::Kernel::get().now() / 1000000));
+  }
+};
+} // namespace Kernel
+
+namespace ThisThread {
+template <typename R, typename P>
+void sleep_for(std::chrono::duration<R, P> d) {
+  host::Kernel &k = host::Kernel::get();
+  k.sleepUntil(k.now() + host::ns(d));
+}
+inline void sleep_until(Kernel::Clock::time_point t) {
+  host::Kernel::get().sleepUntil(host::ns(t.time_since_epoch()));
+}
+inline uint32_t flags_wait_any(uint32_t flags, bool clear = true) {
+  return host::Kernel::get().waitAny(flags, clear);
+}
+inline uint32_t flags_get() {
+  host::Kernel::Lock l(host::Kernel::get().mutex);
+  return host::Kernel::self()->flags;
+}
+inline osThreadId_t get_id() { return (osThreadId_t)host::Kernel::self(); }
+inline void yield() { std::this_thread::yield(); }
+} // namespace ThisThread
+
+} // namespace rtos
+
+namespace events {
+
+/*!
+ *  @brief  Queue of deferred calls, run by whichever thread dispatches it
+ */
+class EventQueue {
+public:
+  EventQueue(unsigned = 0, unsigned char * = nullptr) {}
+  template <typename F> int call(F f) {
+    {
+      std::lock_guard<std::mutex> g(_mutex);
+      _calls.push_back(f);
+    }
+    _ready.release();
+    return 1;
+  }
+  void dispatch_forever() {
+    for (;;) {
+      _ready.acquire();
+      std::function<void()> f;
+      {
+        std::lock_guard<std::mutex> g(_mutex);
+        f = _calls.front();
+        _calls.pop_front();
+      }
+      f();
+    }
+  }
+
+private:
+  std::mutex _mutex;
+  std::deque<std::function<void()>> _calls;
+  rtos::Semaphore _ready;
+};
+
+} // namespace events
+
+/* The shared queue, dispatched from its own thread as mbed-os does. */
+inline events::EventQueue *mbed_event_queue() {
+  static events::EventQueue *queue = [] {
+    events::EventQueue *q = new events::EventQueue;
+    rtos::Thread *t = new rtos::Thread(osPriorityNormal);
+    t->start(mbed::callback(q, &events::EventQueue::dispatch_forever));
+    return q;
+  }();
+  return queue;
+}
+
+class PlatformMutex : public rtos::Mutex {};
+
+using namespace mbed;
+using namespace rtos;
+using namespace events;
+using namespace std;
+
+#endif
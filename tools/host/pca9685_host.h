@@ -0,0 +1,121 @@
+/*!
+ *  @file pca9685_host.h
+ *
+ *  Helpers shared by the host programs in tools/.
+ *
+ *  BSD license, all text above must be included in any redistribution
+ */
+#ifndef _PCA9685_HOST_H
+#define _PCA9685_HOST_H
+
+#include <mbed.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+namespace host {
+
+/*!
+ *  @brief  7-bit address of the nth chip on a bus, skipping the LED All
+ * Call and default subaddresses (0x70, 0x71, 0x72, 0x74); 60 chips fit
+ */
+inline uint8_t chipAddress(unsigned n) {
+  uint8_t addr = 0x40;
+  for (;; addr++) {
+    if (addr == 0x70 || addr == 0x71 || addr == 0x72 || addr == 0x74)
+      continue;
+    if (!n--)
+      return addr;
+  }
+}
+
+/*!
+ *  @brief  Wall-clock stopwatch, for CPU cost (the mbed Timer runs on the
+ * virtual clock)
+ */
+class Stopwatch {
+public:
+  Stopwatch() : _start(std::chrono::steady_clock::now()) {}
+  double seconds() const {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                         _start)
+        .count();
+  }
+
+private:
+  std::chrono::steady_clock::time_point _start;
+};
+
+/*!
+ *  @brief  Sorted samples, for percentiles
+ */
+class Percentiles {
+public:
+  void add(double v) { _v.push_back(v); }
+  size_t count() const { return _v.size(); }
+  /*!
+   *  @brief  Nearest-rank percentile
+   *  @param  p Fraction from 0 to 1
+   */
+  double at(double p) {
+    if (_v.empty())
+      return 0;
+    if (!_sorted)
+      std::sort(_v.begin(), _v.end());
+    _sorted = true;
+    size_t i = (size_t)(p * _v.size());
+    return _v[std::min(i, _v.size() - 1)];
+  }
+
+private:
+  std::vector<double> _v;
+  bool _sorted = false;
+};
+
+/*!
+ *  @brief  xorshift32, so runs repeat from a seed
+ */
+class Random {
+public:
+  explicit Random(uint32_t seed) : _s(seed ? seed : 1) {}
+  uint32_t next() {
+    _s ^= _s << 13;
+    _s ^= _s >> 17;
+    _s ^= _s << 5;
+    return _s;
+  }
+  /* Uniform in 0..n-1 */
+  uint32_t below(uint32_t n) { return (uint32_t)(((uint64_t)next() * n) >> 32); }
+
+private:
+  uint32_t _s;
+};
+
+/*!
+ *  @brief  Value of an unsigned option "--name N", or the default
+ */
+inline unsigned long option(int argc, char **argv, const char *name,
+                            unsigned long fallback) {
+  for (int i = 1; i + 1 < argc; i++)
+    if (!strcmp(argv[i], name))
+      return strtoul(argv[i + 1], NULL, 0);
+  return fallback;
+}
+
+/*!
+ *  @brief  Value of a string option "--name VALUE", or NULL
+ */
+inline const char *stringOption(int argc, char **argv, const char *name) {
+  for (int i = 1; i + 1 < argc; i++)
+    if (!strcmp(argv[i], name))
+      return argv[i + 1];
+  return NULL;
+}
+
+} // namespace host
+
+#endif
@@ -0,0 +1,263 @@
+#!/usr/bin/env python3
+"""Streams PWM frames to a PCA9685Gateway over a serial link.
+
+Each frame is a full set of channel values for the fleet. Only channels that
+changed since the previous frame are sent, one message per chip:
+0xA5 seq flags chip mask(16 bit LE), per channel varint(zigzag(d_on)) if
+ON changed anywhere in the message and varint(zigzag(d_off)), then
+CRC-16/CCITT-FALSE (LE) over seq..values. The last message of a frame carries
+the flush flag.
+
+The gateway answers 0x5A 'A' seq for every applied message and 0x5A 'N' seq
+when it wants everything from seq resent. 0x5A 'R' seq refuses a message that
+can never be applied (a chip the gateway's fleet does not have, or a value
+past 4096); it is not resent, and the chip's next message is absolute. At
+most --window messages are in flight, which keeps the gateway's receive
+buffer from overflowing.
+
+Input is a CSV in the format written by telemetry_decode.py
+(t_us, chip, channel, on, off); rows with the same t_us form one frame and
+frames are paced by t_us. Without input a sweep across all channels is sent.
+
+  tools/pca9685_stream.py /dev/ttyACM0 --baud 921600 --chips 4
+  tools/pca9685_stream.py /dev/ttyACM0 --chips 2 capture.csv
+"""
+
+import argparse
+import collections
+import csv
+import os
+import select
+import sys
+import termios
+import time
+
+SYNC = 0xA5
+REPLY = 0x5A
+FLAG_ON = 0x01
+FLAG_FLUSH = 0x02
+FLAG_ABSOLUTE = 0x04
+
+
+def crc16(data):
+    crc = 0xFFFF
+    for byte in data:
+        crc ^= byte << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021 if crc & 0x8000 else crc << 1) & 0xFFFF
+    return crc
+
+
+def varint(v):
+    out = bytearray()
+    while v >= 0x80:
+        out.append(v & 0x7F | 0x80)
+        v >>= 7
+    out.append(v)
+    return out
+
+
+def zigzag(v):
+    return (v << 1) ^ (v >> 31)
+
+
+def delta(now, then):
+    """Smallest signed difference modulo 2^16, matching uint16_t arithmetic."""
+    d = (now - then) & 0xFFFF
+    return d - 0x10000 if d >= 0x8000 else d
+
+
+class Stream:
+    def __init__(self, fd, chips, window=8, timeout=0.2):
+        self.fd = fd
+        self.chips = chips
+        self.window = window
+        self.timeout = timeout
+        self.seq = 0
+        self.inflight = collections.OrderedDict()
+        self.mirror = [None] * chips
+        self.replies = bytearray()
+        self.sent = 0
+        self.resends = 0
+        self.rejects = 0
+        self.resent = None
+
+    def message(self, chip, values, flush):
+        old = self.mirror[chip]
+        if old is None:
+            mask = 0xFFFF
+            flags = FLAG_ABSOLUTE | FLAG_ON
+        else:
+            mask = sum(1 << n for n in range(16) if values[n] != old[n])
+            if not mask:
+                return None
+            flags = FLAG_ON if any(values[n][0] != old[n][0] for n in range(16)
+                                   if mask & (1 << n)) else 0
+        if flush:
+            flags |= FLAG_FLUSH
+        body = bytearray([self.seq, flags, chip, mask & 0xFF, mask >> 8])
+        for n in range(16):
+            if not mask & (1 << n):
+                continue
+            on, off = values[n]
+            if flags & FLAG_ABSOLUTE:
+                body += varint(on) + varint(off)
+                continue
+            if flags & FLAG_ON:
+                body += varint(zigzag(delta(on, old[n][0])))
+            body += varint(zigzag(delta(off, old[n][1])))
+        crc = crc16(body)
+        self.mirror[chip] = list(values)
+        return bytes([SYNC]) + bytes(body) + bytes([crc & 0xFF, crc >> 8])
+
+    def send_frame(self, frame):
+        """frame[chip][channel] is an (on, off) pair."""
+        messages = [(chip, frame[chip]) for chip in range(self.chips)
+                    if self.mirror[chip] != list(frame[chip])]
+        for i, (chip, values) in enumerate(messages):
+            msg = self.message(chip, values, i == len(messages) - 1)
+            while len(self.inflight) >= self.window:
+                self.wait()
+            self.inflight[self.seq] = msg
+            self.seq = (self.seq + 1) & 0xFF
+            self.sent += 1
+            os.write(self.fd, msg)
+
+    def drain(self):
+        while self.inflight:
+            self.wait()
+
+    def wait(self):
+        ready, _, _ = select.select([self.fd], [], [], self.timeout)
+        if not ready:
+            self.resend(next(iter(self.inflight)), force=True)
+            return
+        self.replies += os.read(self.fd, 256)
+        while len(self.replies) >= 3:
+            if self.replies[0] != REPLY:
+                del self.replies[0]
+                continue
+            kind, seq = self.replies[1], self.replies[2]
+            del self.replies[:3]
+            if kind == ord("A"):
+                self.acked(seq)
+            elif kind == ord("R"):
+                self.rejected(seq)
+            elif kind == ord("N"):
+                self.acked((seq - 1) & 0xFF)
+                if seq in self.inflight:
+                    self.resend(seq)
+                elif (self.seq - seq) & 0xFF > self.window:
+                    self.restart(seq)
+                # else a stale NAK for a message already resent and applied
+
+    def acked(self, seq):
+        if seq not in self.inflight:
+            return
+        self.resent = None
+        while self.inflight:
+            done, _ = self.inflight.popitem(last=False)
+            if done == seq:
+                return
+
+    def rejected(self, seq):
+        # Applied as far as the sequence goes, but the gateway's shadow no
+        # longer matches the mirror for that chip.
+        if seq not in self.inflight:
+            return
+        self.rejects += 1
+        chip = self.inflight[seq][3]
+        if chip < self.chips:
+            self.mirror[chip] = None
+        self.acked(seq)
+
+    def resend(self, seq, force=False):
+        # Later messages were rejected too; go back and send them again.
+        # The gateway NAKs every message after a lost one, so only the first
+        # NAK for a sequence is acted on; a timeout resends regardless.
+        if seq == self.resent and not force:
+            return
+        self.resent = seq
+        self.resends += 1
+        for msg in self.inflight.values():
+            os.write(self.fd, msg)
+
+    def restart(self, seq):
+        # The gateway expects a sequence we no longer hold (it was reset):
+        # continue from its sequence with absolute values.
+        self.inflight.clear()
+        self.seq = seq
+        self.mirror = [None] * self.chips
+
+
+def open_serial(path, baud):
+    fd = os.open(path, os.O_RDWR | os.O_NOCTTY)
+    if os.isatty(fd):
+        attrs = termios.tcgetattr(fd)
+        attrs[0] = attrs[1] = attrs[3] = 0
+        attrs[2] = termios.CS8 | termios.CREAD | termios.CLOCAL
+        speed = getattr(termios, "B%d" % baud)
+        attrs[4] = attrs[5] = speed
+        termios.tcsetattr(fd, termios.TCSANOW, attrs)
+    return fd
+
+
+def csv_frames(path, chips):
+    frame = [[(0, 0)] * 16 for _ in range(chips)]
+    t = None
+    with open(path) as f:
+        for row in csv.DictReader(f):
+            now = int(row["t_us"])
+            if t is not None and now != t:
+                yield t, frame
+            t = now
+            frame[int(row["chip"])][int(row["channel"])] = (int(row["on"]),
+                                                            int(row["off"]))
+    if t is not None:
+        yield t, frame
+
+
+def sweep_frames(chips, rate):
+    step = 0
+    while True:
+        yield step * 1000000 // rate, [
+            [(0, (step * 16 + n * 256 + chip * 64) % 4096) for n in range(16)]
+            for chip in range(chips)]
+        step += 1
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__,
+                                 formatter_class=argparse.RawTextHelpFormatter)
+    ap.add_argument("port")
+    ap.add_argument("input", nargs="?", help="CSV from telemetry_decode.py")
+    ap.add_argument("--baud", type=int, default=115200)
+    ap.add_argument("--chips", type=int, default=1)
+    ap.add_argument("--window", type=int, default=8,
+                    help="messages in flight before waiting for an ACK")
+    ap.add_argument("--rate", type=int, default=50,
+                    help="sweep frames per second")
+    args = ap.parse_args()
+
+    stream = Stream(open_serial(args.port, args.baud), args.chips, args.window)
+    frames = csv_frames(args.input, args.chips) if args.input else \
+        sweep_frames(args.chips, args.rate)
+    start = first = None
+    try:
+        for t, frame in frames:
+            if start is None:
+                start, first = time.monotonic(), t
+            delay = start + (t - first) / 1e6 - time.monotonic()
+            if delay > 0:
+                time.sleep(delay)
+            stream.send_frame(frame)
+        stream.drain()
+    except KeyboardInterrupt:
+        pass
+    print("sent %d messages, %d resends, %d rejected" % (
+        stream.sent, stream.resends, stream.rejects), file=sys.stderr)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
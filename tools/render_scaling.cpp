@@ -0,0 +1,89 @@
+/*!
+ *  @file render_scaling.cpp
+ *
+ *  Host benchmark of PCA9685Renderer scaling: renders frames of a
+ *  CPU-heavy effect into a fleet of PCA9685_FLEET_MAX_CHIPS chips on the
+ *  calling thread alone, then with 1 to PCA9685_RENDER_MAX_WORKERS workers
+ *  helping, and prints the wall time per frame and the speedup over one
+ *  thread. Flushing is left out, so only rendering is timed. The speedup
+ *  is bounded by the cores the host has, which the program prints.
+ *
+ *  The program fails if a frame rendered by several threads differs from
+ *  the same frame computed on one.
+ *
+ *    render_scaling [--frames N] [--work N]
+ *
+ *  --work sets the sines per channel, i.e. how heavy the effect is.
+ *
+ *  BSD license, all text above must be included in any redistribution
+ */
+
+#include "PCA9685Renderer.h"
+#include "pca9685_host.h"
+
+#include <math.h>
+#include <stdio.h>
+
+#include <thread>
+
+static unsigned work;
+
+/* Sum of a few travelling sines per channel */
+static void plasma(uint8_t chip, uint32_t frame, uint16_t *on,
+                   uint16_t *off) {
+  for (uint8_t n = 0; n < 16; n++) {
+    float x = (chip * 16 + n) * 0.01f, sum = 0;
+    for (unsigned k = 1; k <= work; k++)
+      sum += sinf(x * k + frame * 0.05f * k) / k;
+    on[n] = 0;
+    off[n] = (uint16_t)(2048 + 1300 * sum) & 0xFFF;
+  }
+}
+
+int main(int argc, char **argv) {
+  unsigned frames = host::option(argc, argv, "--frames", 200);
+  work = host::option(argc, argv, "--work", 32);
+
+  I2C i2c(NC, NC);
+  PCA9685Fleet fleet(i2c);
+  // nothing is flushed, so the chips need no models or distinct addresses
+  for (unsigned chip = 0; chip < PCA9685_FLEET_MAX_CHIPS; chip++)
+    fleet.add(host::chipAddress(chip % 60));
+
+  printf("%u chips, %u channels, %u sines per channel, %u cores\n",
+         fleet.chips(), 16 * fleet.chips(), work,
+         std::thread::hardware_concurrency());
+  printf("%-8s %12s %10s\n", "threads", "ms/frame", "speedup");
+  double single = 0;
+  int failed = 0;
+  for (uint8_t workers = 0; workers <= PCA9685_RENDER_MAX_WORKERS;
+       workers++) {
+    PCA9685Renderer renderer(fleet, callback(&plasma));
+    renderer.start(workers);
+    host::Stopwatch watch;
+    for (unsigned f = 0; f < frames; f++)
+      renderer.render(f + workers * frames);
+    double ms = watch.seconds() * 1e3 / frames;
+    renderer.stop();
+    if (!workers)
+      single = ms;
+    printf("%-8u %12.3f %10.2f\n", workers + 1, ms, single / ms);
+
+    uint32_t last = frames - 1 + workers * frames;
+    for (uint8_t chip = 0; chip < fleet.chips(); chip++) {
+      uint16_t on[16], off[16], got_on, got_off;
+      plasma(chip, last, on, off);
+      for (uint8_t n = 0; n < 16; n++) {
+        fleet.getPWM(chip, n, &got_on, &got_off);
+        if (got_on != on[n] || got_off != off[n]) {
+          printf("FAIL: %u threads: chip %u channel %u holds %u, expected "
+                 "%u\n",
+                 workers + 1, chip, n, got_off, off[n]);
+          failed = 1;
+          break;
+        }
+      }
+    }
+  }
+  return failed;
+}
@@ -0,0 +1,140 @@
+/*!
+ *  @file seqlock_stress.cpp
+ *
+ *  Host stress test of the PCA9685Fleet sequence lock. One writer thread
+ *  per chip rewrites its 16 channels in a loop, frame k writing channel n
+ *  as ON = k and OFF = k * 7 + n (mod 65536), while reader threads take
+ *  getPWM() and snapshot() copies as fast as they can. A read is torn when
+ *
+ *    - a channel's OFF does not belong to its ON,
+ *    - a snapshot is not a state the writer passed through: channels are
+ *      written in order, so channel n may be at most one frame ahead of
+ *      channel n + 1, never behind it,
+ *    - a reader sees a channel go back to an older frame.
+ *
+ *  Reads must not touch the bus either. The program fails on any torn read;
+ *  built with PCA9685_ENABLE_SEQLOCK=0 it finds some within a few million
+ *  reads, even on one core.
+ *
+ *    seqlock_stress [--frames N] [--readers N]
+ *
+ *  BSD license, all text above must be included in any redistribution
+ */
+
+#include "PCA9685Fleet.h"
+#include "pca9685_host.h"
+
+#include <stdio.h>
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+static const uint8_t CHIPS = 2;
+
+static PCA9685Fleet *fleet;
+static std::atomic<int> writing;
+static unsigned frames;
+
+struct Reader {
+  unsigned long reads = 0, torn = 0;
+  uint16_t last[CHIPS][16]; // frame last seen per channel
+  bool seen[CHIPS][16];
+  int index;
+
+  Reader(int i) : index(i) { memset(seen, 0, sizeof(seen)); }
+
+  /* Checks one channel; returns false if torn. */
+  bool check(uint8_t chip, uint8_t n, uint16_t on, uint16_t off) {
+    if (!on && off == 4096)
+      return true; // not written yet
+    if (off != (uint16_t)(on * 7 + n))
+      return false;
+    if (seen[chip][n] && (int16_t)(on - last[chip][n]) < 0)
+      return false;
+    seen[chip][n] = true;
+    last[chip][n] = on;
+    return true;
+  }
+
+  void run() {
+    uint16_t on[16], off[16];
+    while (writing.load()) {
+      for (uint8_t chip = 0; chip < CHIPS; chip++) {
+        bool ok = true;
+        if ((reads + index) & 1) {
+          uint8_t n = reads % 16;
+          fleet->getPWM(chip, n, on, off);
+          ok = check(chip, n, on[0], off[0]);
+        } else {
+          fleet->snapshot(chip, on, off);
+          for (uint8_t n = 0; n < 16; n++)
+            ok &= check(chip, n, on[n], off[n]);
+          for (uint8_t n = 0; n + 1 < 16 && on[n + 1]; n++) {
+            int16_t ahead = on[n] - on[n + 1];
+            ok &= ahead == 0 || ahead == 1;
+          }
+        }
+        torn += !ok;
+        reads++;
+      }
+    }
+  }
+};
+
+static void writer(uint8_t *chip) {
+  for (unsigned k = 1; k <= frames; k++)
+    for (uint8_t n = 0; n < 16; n++)
+      fleet->setPWM(*chip, n, (uint16_t)k, (uint16_t)(k * 7 + n));
+  writing--;
+}
+
+int main(int argc, char **argv) {
+  frames = host::option(argc, argv, "--frames", 500000);
+  unsigned readers = host::option(argc, argv, "--readers", 3);
+
+  I2C i2c(NC, NC);
+  for (uint8_t chip = 0; chip < CHIPS; chip++)
+    i2c.attach(host::chipAddress(chip));
+  fleet = new PCA9685Fleet(i2c);
+  for (uint8_t chip = 0; chip < CHIPS; chip++)
+    fleet->add(host::chipAddress(chip));
+  uint64_t transfers = i2c.transfers();
+
+  std::vector<std::unique_ptr<Reader>> reading;
+  std::vector<std::unique_ptr<Thread>> threads;
+  uint8_t chips[CHIPS];
+  writing = CHIPS;
+  host::Stopwatch watch;
+  for (unsigned r = 0; r < readers; r++) {
+    reading.emplace_back(new Reader(r));
+    threads.emplace_back(new Thread);
+    threads.back()->start(callback(reading.back().get(), &Reader::run));
+  }
+  for (uint8_t chip = 0; chip < CHIPS; chip++) {
+    chips[chip] = chip;
+    threads.emplace_back(new Thread);
+    threads.back()->start(callback(&writer, chips + chip));
+  }
+  for (auto &t : threads)
+    t->join();
+  double seconds = watch.seconds();
+
+  unsigned long reads = 0, torn = 0;
+  for (auto &r : reading) {
+    reads += r->reads;
+    torn += r->torn;
+  }
+  printf("%u writers x %u frames, %u readers: %lu reads in %.2f s "
+         "(%.0f reads/s), %lu torn\n",
+         CHIPS, frames, readers, reads, seconds, reads / seconds, torn);
+  if (i2c.transfers() != transfers) {
+    printf("FAIL: reads went to the bus\n");
+    return 1;
+  }
+  if (torn) {
+    printf("FAIL: torn reads\n");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,135 @@
+/*!
+ *  @file size_firmware.cpp
+ *
+ *  Smallest firmware that uses the library, linked by tools/size_report.py
+ *  to measure its footprint. It drives one chip through mbed_PWMServoDriver
+ *  and calls into every feature the configuration enables, so the image
+ *  holds what an application using that feature pulls in: the library code
+ *  and the C library, RTOS and runtime parts it needs. It is never run.
+ *
+ *  BSD license, all text above must be included in any redistribution
+ */
+
+#include "mbed_PWMServoDriver.h"
+#if PCA9685_ENABLE_TELEMETRY
+#include "PCA9685Telemetry.h"
+#endif
+#if PCA9685_ENABLE_WATCHDOG
+#include "PCA9685Watchdog.h"
+#endif
+#if PCA9685_ENABLE_FLEET
+#include "PCA9685Fleet.h"
+#endif
+#if PCA9685_ENABLE_SCHEDULER
+#include "PCA9685Scheduler.h"
+#endif
+#if PCA9685_ENABLE_GATEWAY
+#include "PCA9685Gateway.h"
+#endif
+#if PCA9685_ENABLE_RENDERER
+#include "PCA9685Renderer.h"
+#endif
+#if PCA9685_ENABLE_EFFECTS
+#include "PCA9685Effects.h"
+#endif
+#if PCA9685_ENABLE_SPLINE
+#include "PCA9685Spline.h"
+#endif
+
+static I2C i2c(I2C_SDA, I2C_SCL);
+static mbed_PWMServoDriver pwm(0x40, i2c);
+
+#if PCA9685_ENABLE_TELEMETRY
+static uint8_t log_buffer[256];
+static PCA9685Telemetry telemetry(log_buffer, sizeof(log_buffer));
+#endif
+#if PCA9685_ENABLE_FLEET
+static PCA9685Fleet fleet(i2c);
+#endif
+#if PCA9685_ENABLE_GATEWAY
+static BufferedSerial serial(USBTX, USBRX, 921600);
+#endif
+#if PCA9685_ENABLE_SPLINE
+static const PCA9685Keyframe keys[] = {{205, 50}, {410, 50}};
+#endif
+
+#if PCA9685_ENABLE_RENDERER
+static void dim(uint8_t, uint32_t frame, uint16_t *on, uint16_t *off) {
+  for (uint8_t n = 0; n < 16; n++) {
+    on[n] = 0;
+    off[n] = frame & 0xFFF;
+  }
+}
+#endif
+#if PCA9685_ENABLE_FAULT_INJECTION
+static PCA9685Fault noFault(uint8_t) { return PCA9685_FAULT_NONE; }
+#endif
+
+int main() {
+  pwm.begin<50>();
+  pwm.setPWM(0, 0, 2048);
+#if PCA9685_ENABLE_TELEMETRY
+  pwm.setTelemetry(&telemetry);
+#endif
+#if PCA9685_ENABLE_SHADOW
+  if (!pwm.checkHealth())
+    pwm.restore();
+#endif
+#if PCA9685_ENABLE_AUTOBATCH
+  pwm.setAutoBatch(chrono::milliseconds(2));
+  pwm.flush();
+#endif
+#if PCA9685_ENABLE_WATCHDOG
+  pwm.setFailsafe(NULL);
+  static PCA9685Watchdog watchdog(chrono::milliseconds(500));
+  watchdog.add(pwm);
+  watchdog.start();
+#endif
+
+#if PCA9685_ENABLE_FLEET
+  fleet.add(0x41);
+  fleet.reset(PCA9685Prescale<50>::value);
+  fleet.setPWM(0, 0, 0, 1024);
+  fleet.flush();
+#if PCA9685_ENABLE_TELEMETRY
+  fleet.setTelemetry(&telemetry);
+#endif
+#if PCA9685_ENABLE_STATS
+  fleet.resetStats();
+#endif
+#if PCA9685_ENABLE_CHANNEL_STATS
+  PCA9685ChannelStats counts[16];
+  fleet.channelStats(0, counts);
+#endif
+#if PCA9685_ENABLE_SOFT_START
+  fleet.softStart(NULL, 16, chrono::milliseconds(10));
+#endif
+#if PCA9685_ENABLE_FAULT_INJECTION
+  fleet.setFaultHook(callback(&noFault));
+#endif
+#if PCA9685_ENABLE_EFFECTS
+  PCA9685Effects effects(fleet, 0, 16);
+  effects.wave(0, 4096);
+#endif
+#if PCA9685_ENABLE_SPLINE
+  static PCA9685Spline spline(fleet);
+  spline.attach(1, keys, 2, true);
+  spline.tick();
+#endif
+#if PCA9685_ENABLE_RENDERER
+  PCA9685Renderer renderer(fleet, callback(&dim));
+  renderer.render(0);
+#endif
+#if PCA9685_ENABLE_SCHEDULER
+  static PCA9685Scheduler scheduler(fleet);
+  scheduler.start(chrono::milliseconds(20));
+#endif
+#if PCA9685_ENABLE_GATEWAY
+  static PCA9685Gateway gateway(serial, fleet);
+  gateway.run();
+#endif
+#endif
+
+  for (;;)
+    ThisThread::sleep_for(chrono::seconds(1));
+}
@@ -0,0 +1,238 @@
+#!/usr/bin/env python3
+"""Flash/RAM footprint report for the mbed_PWMServoDriver library.
+
+Links tools/size_firmware.cpp, a minimal firmware that calls into every
+enabled feature, with the library once per feature configuration
+(-ffunction-sections, --gc-sections), so the figures are what the feature
+costs in an image: the library code plus whatever C library, RTOS and
+runtime parts it pulls in (printf, float and libm, threads). For each
+configuration it reports the image's .text/.data/.bss, the largest symbols
+(nm on the linked image) and the largest contributors by input file and
+archive member (from the linker map), each with the delta against the
+checked-in baseline (tools/size_baseline.json), and for each switch what
+turning it off or on changes against the default configuration.
+
+Configurations are derived from the PCA9685_ENABLE_* switches found in the
+library headers:
+  default     every switch at its default
+  minimal     every switch off
+  no-<name>   default with only that switch off (switches on by default)
+  with-<name> default with only that switch on (switches off by default)
+
+Without --prefix the image is built for the host against the mbed-os
+stand-in in tools/host; it is only a relative measure (the C library is
+linked dynamically there). For Cortex-M0+ pass the toolchain and what the
+link needs from an mbed-os build (objects or archive, linker script, specs):
+
+  # host
+  tools/size_report.py
+  # Cortex-M0+, e.g. against an mbed-cli BUILD of mbed-os for the target
+  tools/size_report.py --label cm0plus --prefix arm-none-eabi- \\
+      --cflags "-mcpu=cortex-m0plus -mthumb -Os -std=gnu++14" \\
+      -I $MBED_OS -I ... \\
+      --ldflags "-mcpu=cortex-m0plus -mthumb --specs=nano.specs \\
+                 -T BUILD/.../linker_script.ld BUILD/.../mbed-os.a"
+  # refresh the baseline after an intentional change
+  tools/size_report.py --label cm0plus ... --update
+
+The checked-in baseline holds the host label only; a cm0plus entry needs
+the ARM toolchain and an mbed-os build, and is added with --update.
+"""
+
+import argparse
+import collections
+import glob
+import json
+import os
+import re
+import shlex
+import subprocess
+import sys
+import tempfile
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+TOOLS = os.path.join(ROOT, "tools")
+BASELINE = os.path.join(TOOLS, "size_baseline.json")
+FIRMWARE = os.path.join(TOOLS, "size_firmware.cpp")
+
+# largest symbols and inputs kept per configuration in the baseline
+KEEP = 20
+
+
+def features():
+    """(name, default) of every switch; the default may name another."""
+    found = collections.OrderedDict()
+    for header in sorted(glob.glob(os.path.join(ROOT, "*.h"))):
+        with open(header) as f:
+            text = f.read()
+        for m in re.finditer(r"#ifndef\s+(PCA9685_ENABLE_\w+)\s*"
+                             r"(?://.*\n|/\*.*\*/\s*\n)*"
+                             r"\s*#define\s+\1\s+(\w+)", text):
+            found.setdefault(m.group(1), m.group(2))
+    return found
+
+
+def configurations(switches):
+    configs = collections.OrderedDict()
+    configs["default"] = {}
+    configs["minimal"] = {n: 0 for n in switches}
+    for n, default in switches.items():
+        short = n[len("PCA9685_ENABLE_"):].lower()
+        if default == "0":
+            configs["with-" + short] = {n: 1}
+        else:
+            configs["no-" + short] = {n: 0}
+    return configs
+
+
+def run(cmd):
+    return subprocess.run(cmd, check=True, capture_output=True, text=True).stdout
+
+
+def short(path):
+    """Input file as shown: object name, or archive(member)."""
+    m = re.match(r"(.*?)\((.*)\)$", path)
+    if m:
+        return "%s(%s)" % (os.path.basename(m.group(1)), m.group(2))
+    name = os.path.basename(path)
+    return name[:-2] if name.endswith(".cpp.o") else name
+
+
+def map_inputs(path):
+    """Bytes each input file puts into the code and data output sections;
+    linker-made ones (dynamic symbols, relocations, heap and stack) are left
+    out, the map credits them to whichever file came first."""
+    sizes = collections.Counter()
+    keep = (".text", ".rodata", ".data", ".bss", ".init_array", ".fini_array",
+            ".tdata", ".tbss", ".eh_frame", ".gcc_except_table", ".ARM.ex")
+    section = None
+    pending = False
+    started = False
+    with open(path) as f:
+        for line in f:
+            if not started:
+                started = line.startswith("Linker script and memory map")
+                continue
+            m = re.match(r"^(\.\S+|COMMON)", line)
+            if m:  # output section
+                section = m.group(1)
+                continue
+            if re.match(r"^ (\.\S+|COMMON)\s*$", line):
+                pending = True  # input section name, rest on the next line
+                continue
+            m = re.match(r"^ (\.\S+|COMMON)?\s+0x([0-9a-f]+)\s+0x([0-9a-f]+)"
+                         r"\s+(\S.*?)\s*$", line)
+            if m and (m.group(1) or pending) and section and \
+                    section.startswith(keep) and \
+                    not section.startswith(".eh_frame_hdr"):
+                sizes[short(m.group(4))] += int(m.group(3), 16)
+            pending = False
+    return sizes
+
+
+def measure(args, defines, tmp):
+    sources = sorted(glob.glob(os.path.join(ROOT, "*.cpp"))) + [FIRMWARE]
+    objects = []
+    for src in sources:
+        obj = os.path.join(tmp, os.path.basename(src) + ".o")
+        cmd = [args.prefix + args.cxx, "-c", src, "-o", obj,
+               "-ffunction-sections", "-fdata-sections", "-I", ROOT]
+        cmd += shlex.split(args.cflags)
+        cmd += ["-I" + inc for inc in args.include]
+        cmd += ["-D%s=%d" % kv for kv in defines.items()]
+        run(cmd)
+        objects.append(obj)
+    elf = os.path.join(tmp, "firmware.elf")
+    mapfile = os.path.join(tmp, "firmware.map")
+    run([args.prefix + args.cxx] + objects +
+        ["-o", elf, "-Wl,--gc-sections", "-Wl,-Map=" + mapfile] +
+        shlex.split(args.ldflags))
+
+    # Berkeley format: text data bss dec hex filename
+    line = run([args.prefix + "size", elf]).splitlines()[1].split()
+    result = {"text": int(line[0]), "data": int(line[1]), "bss": int(line[2])}
+    symbols = collections.Counter()
+    for sym in run([args.prefix + "nm", "-S", "-C", "--size-sort",
+                    elf]).splitlines():
+        parts = sym.split(None, 3)
+        if len(parts) == 4 and parts[2] in "TtDdBbRrVvWw":
+            symbols[parts[3]] += int(parts[1], 16)
+    result["symbols"] = symbols
+    result["inputs"] = map_inputs(mapfile)
+    return result
+
+
+def delta(now, then):
+    return "%+d" % (now - then) if then is not None else "new"
+
+
+def top(sizes, old, count):
+    for name, size in sorted(sizes.items(), key=lambda kv: -kv[1])[:count]:
+        print("    %7d %-8s %s" % (size, delta(size, old.get(name)), name))
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__,
+                                 formatter_class=argparse.RawTextHelpFormatter)
+    ap.add_argument("--label", default="host",
+                    help="toolchain label used as the baseline key")
+    ap.add_argument("--prefix", default="", help="toolchain prefix")
+    ap.add_argument("--cxx", default="g++")
+    ap.add_argument("--cflags", default="-Os -std=c++17")
+    ap.add_argument("--ldflags", default=None,
+                    help="link flags and libraries (host default: -pthread)")
+    ap.add_argument("-I", dest="include", action="append", default=[])
+    ap.add_argument("--symbols", type=int, default=10,
+                    help="largest symbols and inputs to list per configuration")
+    ap.add_argument("--only", action="append", default=[],
+                    help="measure only this configuration (repeatable)")
+    ap.add_argument("--update", action="store_true",
+                    help="rewrite the baseline for this label")
+    args = ap.parse_args()
+    if not args.prefix and not args.include:
+        args.include = [os.path.join(TOOLS, "host")]
+    if args.ldflags is None:
+        args.ldflags = "" if args.prefix else "-pthread"
+
+    baseline = {}
+    if os.path.exists(BASELINE):
+        with open(BASELINE) as f:
+            baseline = json.load(f)
+    base = baseline.get(args.label, {})
+
+    configs = configurations(features())
+    results = collections.OrderedDict()
+    for name, defines in configs.items():
+        if args.only and name not in args.only and name != "default":
+            continue
+        with tempfile.TemporaryDirectory() as tmp:
+            results[name] = measure(args, defines, tmp)
+        r, b = results[name], base.get(name, {})
+        print("%-24s text %7d (%s)  data %5d (%s)  bss %6d (%s)" % (
+            name, r["text"], delta(r["text"], b.get("text")),
+            r["data"], delta(r["data"], b.get("data")),
+            r["bss"], delta(r["bss"], b.get("bss"))))
+        if name != "default":
+            d = results["default"]
+            print("    against default: text %+d  data %+d  bss %+d" % (
+                r["text"] - d["text"], r["data"] - d["data"],
+                r["bss"] - d["bss"]))
+        print("  symbols")
+        top(r["symbols"], b.get("symbols", {}), args.symbols)
+        print("  inputs")
+        top(r["inputs"], b.get("inputs", {}), args.symbols)
+
+    if args.update:
+        for name, r in results.items():
+            for key in ("symbols", "inputs"):
+                r[key] = dict(sorted(r[key].items(),
+                                     key=lambda kv: -kv[1])[:KEEP])
+        baseline.setdefault(args.label, {}).update(results)
+        with open(BASELINE, "w") as f:
+            json.dump(baseline, f, indent=1, sort_keys=True)
+            f.write("\n")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,204 @@
+/*!
+ *  @file soak.cpp
+ *
+ *  Host soak test of a PCA9685Fleet under concurrent use, in virtual time.
+ *
+ *  Each producer thread owns one chip and sets random channels to random
+ *  values at random intervals; a flusher thread flushes the fleet at a
+ *  fixed rate; a control thread, through a separate mbed_PWMServoDriver on
+ *  a random chip, now and then changes the PWM frequency or puts the chip
+ *  to sleep and wakes it, telling the fleet with invalidate(). The bus is
+ *  the PCA9685 model of tools/host, so an hour of bus traffic runs in
+ *  seconds.
+ *
+ *  The latency of an update runs from setPWM() to the chip latching the
+ *  value. At the end the program prints throughput, the p50/p99/p999
+ *  latencies and the fleet counters, flushes once more and compares every
+ *  chip with the shadow, both with PCA9685Fleet::verify() and directly in
+ *  the model. It fails on any divergence or on an update that never
+ *  arrived.
+ *
+ *    soak [--seconds N] [--producers N] [--flush-ms N] [--seed N]
+ *
+ *  BSD license, all text above must be included in any redistribution
+ */
+
+#include "PCA9685Fleet.h"
+#include "mbed_PWMServoDriver.h"
+#include "pca9685_host.h"
+
+#include <stdio.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+static const uint64_t DELIVERED = 1ull << 63;
+
+static PCA9685Fleet *fleet;
+static std::atomic<bool> running(true);
+static unsigned flush_ms;
+static uint32_t seed;
+
+// per channel: request time in us (bits 0-31), OFF value (32-47), DELIVERED
+static std::vector<std::atomic<uint64_t>> requests;
+static std::mutex latency_mutex;
+static host::Percentiles latency_us;
+static std::atomic<unsigned long> updates(0), delivered(0);
+
+static uint8_t chipOf(uint8_t addr) {
+  for (uint8_t chip = 0; chip < fleet->chips(); chip++)
+    if (fleet->address(chip) == addr)
+      return chip;
+  return 0xFF;
+}
+
+/* Bus observer: a chip latched a channel. */
+static void latched(uint8_t addr, uint8_t n, uint16_t, uint16_t off) {
+  uint8_t chip = chipOf(addr);
+  if (chip == 0xFF)
+    return;
+  std::atomic<uint64_t> &request = requests[16 * chip + n];
+  uint64_t r = request.load();
+  if ((r & DELIVERED) || (uint16_t)(r >> 32) != off)
+    return; // an older value, or counted already
+  if (!request.compare_exchange_strong(r, r | DELIVERED))
+    return;
+  delivered++;
+  std::lock_guard<std::mutex> g(latency_mutex);
+  latency_us.add((uint32_t)(us_ticker_read() - (uint32_t)r));
+}
+
+static void produce(uint8_t *chip) {
+  host::Random rng(seed + *chip);
+  uint16_t last[16];
+  for (uint8_t n = 0; n < 16; n++)
+    last[n] = 4096;
+  while (running) {
+    ThisThread::sleep_for(chrono::microseconds(200 + rng.below(4000)));
+    uint8_t n = rng.below(16);
+    uint16_t off = rng.below(4096);
+    if (off == last[n])
+      continue;
+    last[n] = off;
+    requests[16 * *chip + n].store((uint64_t)off << 32 | us_ticker_read());
+    fleet->setPWM(*chip, n, 0, off);
+    updates++;
+  }
+}
+
+static void flusher() {
+  while (running) {
+    ThisThread::sleep_for(chrono::milliseconds(flush_ms));
+    fleet->flush();
+  }
+}
+
+static void control(I2C *i2c) {
+  host::Random rng(seed ^ 0xC0FFEE);
+  unsigned changes = 0, naps = 0;
+  while (running) {
+    ThisThread::sleep_for(chrono::milliseconds(500 + rng.below(3000)));
+    uint8_t chip = rng.below(fleet->chips());
+    mbed_PWMServoDriver pwm(fleet->address(chip), *i2c);
+    if (rng.below(2)) {
+      pwm.setPWMFreq(40 + rng.below(960));
+      changes++;
+    } else {
+      pwm.sleep();
+      ThisThread::sleep_for(chrono::milliseconds(1 + rng.below(50)));
+      pwm.wakeup();
+      naps++;
+    }
+    fleet->invalidate(chip);
+  }
+  printf("control: %u frequency changes, %u sleep/wake cycles\n", changes,
+         naps);
+}
+
+int main(int argc, char **argv) {
+  unsigned seconds = host::option(argc, argv, "--seconds", 600);
+  unsigned producers = host::option(argc, argv, "--producers", 4);
+  flush_ms = host::option(argc, argv, "--flush-ms", 5);
+  seed = host::option(argc, argv, "--seed", 1);
+  if (producers < 1 || producers > 60)
+    producers = 4;
+
+  I2C i2c(NC, NC);
+  i2c.frequency(400000);
+  for (unsigned chip = 0; chip < producers; chip++)
+    i2c.attach(host::chipAddress(chip));
+  fleet = new PCA9685Fleet(i2c);
+  for (unsigned chip = 0; chip < producers; chip++)
+    fleet->add(host::chipAddress(chip));
+  fleet->reset(PCA9685Prescale<200>::value);
+  fleet->resetStats();
+  requests = std::vector<std::atomic<uint64_t>>(16 * producers);
+  for (auto &r : requests)
+    r = DELIVERED;
+  i2c.observe(latched);
+
+  host::Stopwatch watch;
+  uint32_t start_us = us_ticker_read();
+  std::vector<std::unique_ptr<Thread>> threads;
+  std::vector<uint8_t> chips(producers);
+  for (unsigned p = 0; p < producers; p++) {
+    chips[p] = p;
+    threads.emplace_back(new Thread);
+    threads.back()->start(callback(&produce, &chips[p]));
+  }
+  threads.emplace_back(new Thread(osPriorityHigh));
+  threads.back()->start(callback(&flusher));
+  threads.emplace_back(new Thread);
+  threads.back()->start(callback(&control, &i2c));
+
+  ThisThread::sleep_for(chrono::seconds(seconds));
+  running = false;
+  for (auto &t : threads)
+    t->join();
+  fleet->flush();
+  double virtual_s = (us_ticker_read() - start_us) / 1e6;
+
+  PCA9685FleetStats stats = fleet->stats();
+  printf("%u producers, %.0f s virtual in %.2f s wall (x%.0f)\n", producers,
+         virtual_s, watch.seconds(), virtual_s / watch.seconds());
+  printf("updates %lu (%.0f/s), delivered %lu, bus %llu bytes\n",
+         updates.load(), updates.load() / virtual_s, delivered.load(),
+         (unsigned long long)i2c.bytes());
+  printf("latency us: p50 %.0f  p99 %.0f  p999 %.0f  max %.0f\n",
+         latency_us.at(0.5), latency_us.at(0.99), latency_us.at(0.999),
+         latency_us.at(1));
+  printf("requested %u suppressed %u coalesced %u transmitted %u failed %u "
+         "frames_lost %u\n",
+         stats.requested, stats.suppressed, stats.coalesced,
+         stats.transmitted, stats.failed, stats.frames_lost);
+
+  int failed = 0;
+  for (uint8_t chip = 0; chip < fleet->chips(); chip++) {
+    int diverged = fleet->verify(chip);
+    host::PCA9685Model *model = i2c.chip(fleet->address(chip));
+    for (uint8_t n = 0; n < 16; n++) {
+      uint16_t on, off, chip_on, chip_off;
+      fleet->getPWM(chip, n, &on, &off);
+      model->led(n, &chip_on, &chip_off);
+      if (on != chip_on || off != chip_off)
+        diverged |= 1 << n;
+      if (!(requests[16 * chip + n].load() & DELIVERED)) {
+        printf("FAIL: chip %u channel %u: last update never arrived\n", chip,
+               n);
+        failed = 1;
+      }
+    }
+    if (diverged) {
+      printf("FAIL: chip %u diverged from the shadow, channels 0x%04x\n",
+             chip, diverged & 0xFFFF);
+      failed = 1;
+    }
+    if (!model->awake()) {
+      printf("FAIL: chip %u left asleep\n", chip);
+      failed = 1;
+    }
+  }
+  return failed;
+}
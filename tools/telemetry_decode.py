@@ -0,0 +1,78 @@
+#!/usr/bin/env python3
+"""Expands a PCA9685Telemetry stream into a CSV file.
+
+The input is the concatenation of blocks written by PCA9685Telemetry::drain():
+'P' 'T' varint(length) followed by records of
+varint(dt_us) chip channel varint(zigzag(d_on)) varint(zigzag(d_off)).
+
+Output columns: t_us (monotonic across the whole capture, unwrapped from the
+32-bit microsecond ticker), chip, channel, on, off.
+
+  tools/telemetry_decode.py capture.bin > capture.csv
+"""
+
+import argparse
+import csv
+import sys
+
+
+def varint(data, pos):
+    value = shift = 0
+    while True:
+        byte = data[pos]
+        pos += 1
+        value |= (byte & 0x7F) << shift
+        shift += 7
+        if not byte & 0x80:
+            return value, pos
+
+
+def unzigzag(v):
+    return (v >> 1) ^ -(v & 1)
+
+
+def decode(data):
+    pos = 0
+    t = None
+    while pos < len(data):
+        if data[pos:pos + 2] != b"PT":
+            raise ValueError("bad block header at offset %d" % pos)
+        length, pos = varint(data, pos + 2)
+        end = pos + length
+        stamp, on, off = 0, 0, 0
+        first = True
+        while pos < end:
+            dt, pos = varint(data, pos)
+            chip, channel = data[pos], data[pos + 1]
+            d_on, pos = varint(data, pos + 2)
+            d_off, pos = varint(data, pos)
+            stamp = (stamp + dt) & 0xFFFFFFFF
+            on += unzigzag(d_on)
+            off += unzigzag(d_off)
+            if t is None:
+                t = stamp
+            elif first:
+                # blocks restart from the absolute ticker value
+                t += (stamp - last) & 0xFFFFFFFF
+            else:
+                t += dt
+            first = False
+            last = stamp
+            yield t, chip, channel, on, off
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__,
+                                 formatter_class=argparse.RawTextHelpFormatter)
+    ap.add_argument("input", type=argparse.FileType("rb"))
+    ap.add_argument("-o", "--output", type=argparse.FileType("w"),
+                    default=sys.stdout)
+    args = ap.parse_args()
+    out = csv.writer(args.output)
+    out.writerow(["t_us", "chip", "channel", "on", "off"])
+    out.writerows(decode(args.input.read()))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,168 @@
+/*!
+ *  @file telemetry_roundtrip.cpp
+ *
+ *  Round-trip test of PCA9685Telemetry with the real decoder: records a
+ *  random setpoint sequence in virtual time, drains it now and then into a
+ *  file, runs tools/telemetry_decode.py on the file and checks that the CSV
+ *  holds every record the recorder kept (those not counted in dropped()),
+ *  in order, with its time, chip, channel and values.
+ *
+ *  The file is written through a handle that cuts writes short at random
+ *  and, with --fail N, fails every Nth write with -EAGAIN, so blocks left
+ *  half written by one drain() and finished by the next are exercised too.
+ *
+ *    telemetry_roundtrip --python PATH --script PATH [--records N]
+ *                        [--buffer N] [--fail N] [--seed N]
+ *
+ *  BSD license, all text above must be included in any redistribution
+ */
+
+#include "PCA9685Telemetry.h"
+#include "pca9685_host.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/* Capture file, written in random pieces with the odd failure */
+class FlakyFile : public FileHandle {
+public:
+  FlakyFile(FILE *f, unsigned fail, host::Random &rng)
+      : _f(f), _fail(fail), _rng(rng) {}
+  ssize_t read(void *, size_t) override { return -EINVAL; }
+  ssize_t write(const void *buffer, size_t size) override {
+    if (_fail && ++_calls % _fail == 0) {
+      failed++;
+      return -EAGAIN;
+    }
+    size_t n = size > 1 && _rng.below(2) ? 1 + _rng.below(size - 1) : size;
+    shortened += n < size;
+    return fwrite(buffer, 1, n, _f);
+  }
+  unsigned long failed = 0, shortened = 0;
+
+private:
+  FILE *_f;
+  unsigned _fail;
+  host::Random &_rng;
+  unsigned long _calls = 0;
+};
+
+struct Record {
+  uint64_t t_us;
+  unsigned chip, channel, on, off;
+};
+
+int main(int argc, char **argv) {
+  const char *python = host::stringOption(argc, argv, "--python");
+  const char *script = host::stringOption(argc, argv, "--script");
+  unsigned records = host::option(argc, argv, "--records", 20000);
+  unsigned size = host::option(argc, argv, "--buffer", 512);
+  unsigned fail = host::option(argc, argv, "--fail", 0);
+  host::Random rng(host::option(argc, argv, "--seed", 1));
+  if (!python || !script || size < 16) {
+    fprintf(stderr, "usage: %s --python PATH --script PATH [--records N] "
+                    "[--buffer N] [--fail N] [--seed N]\n",
+            argv[0]);
+    return 2;
+  }
+
+  char bin[] = "/tmp/telemetry_XXXXXX.bin", csv[] = "/tmp/telemetry_XXXXXX.csv";
+  FILE *capture = fdopen(mkstemps(bin, 4), "wb");
+  close(mkstemps(csv, 4));
+  FlakyFile file(capture, fail, rng);
+  std::vector<uint8_t> buffer(size);
+  PCA9685Telemetry telemetry(buffer.data(), size);
+
+  // kept records, on a 64-bit clock unwrapped from the ticker
+  std::vector<Record> kept;
+  uint64_t clock = us_ticker_read();
+  uint32_t last = us_ticker_read();
+  unsigned long drains = 0, errors = 0;
+  for (unsigned i = 0; i < records; i++) {
+    // mostly close together, now and then seconds apart; the stream cannot
+    // tell gaps of more than one ticker wrap (71 minutes) between blocks
+    wait_us(rng.below(8) ? rng.below(2000) : rng.below(10000000));
+    uint32_t now = us_ticker_read();
+    clock += now - last;
+    last = now;
+    Record r = {clock, host::chipAddress(rng.below(60)), rng.below(16),
+                rng.below(4) ? 0u : rng.below(4096), rng.below(4097)};
+    uint32_t dropped = telemetry.dropped();
+    telemetry.record(r.chip, r.channel, r.on, r.off);
+    if (telemetry.dropped() == dropped)
+      kept.push_back(r);
+    if (rng.below(32) == 0) {
+      drains++;
+      errors += telemetry.drain(file) < 0;
+    }
+  }
+  for (int tries = 0; telemetry.drain(file) < 0; tries++) {
+    if (tries == 100) {
+      printf("FAIL: the last block never got out\n");
+      return 1;
+    }
+  }
+  long bytes = ftell(capture);
+  fclose(capture);
+
+  pid_t decoder = fork();
+  if (!decoder) {
+    execl(python, python, script, bin, "-o", csv, (char *)NULL);
+    perror(python);
+    _exit(127);
+  }
+  int status = 0;
+  waitpid(decoder, &status, 0);
+
+  int failed = 0;
+  if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+    printf("FAIL: decoder exited with status %d\n", status);
+    failed = 1;
+  }
+  FILE *f = fopen(csv, "r");
+  char line[128];
+  size_t n = 0;
+  uint64_t t0 = 0;
+  while (!failed && f && fgets(line, sizeof(line), f)) {
+    unsigned long long t;
+    unsigned chip, channel, on, off;
+    if (sscanf(line, "%llu,%u,%u,%u,%u", &t, &chip, &channel, &on, &off) != 5)
+      continue; // header
+    if (n >= kept.size()) {
+      printf("FAIL: decoded more records than the %zu kept\n", kept.size());
+      failed = 1;
+      break;
+    }
+    const Record &r = kept[n];
+    if (!n)
+      t0 = t;
+    if (t - t0 != r.t_us - kept[0].t_us || chip != r.chip ||
+        channel != r.channel || on != r.on || off != r.off) {
+      printf("FAIL: record %zu decoded as t+%llu %u/%u %u/%u, recorded as "
+             "t+%llu %u/%u %u/%u\n",
+             n, (unsigned long long)(t - t0), chip, channel, on, off,
+             (unsigned long long)(r.t_us - kept[0].t_us), r.chip, r.channel,
+             r.on, r.off);
+      failed = 1;
+    }
+    n++;
+  }
+  if (f)
+    fclose(f);
+  if (!failed && n != kept.size()) {
+    printf("FAIL: decoded %zu of the %zu records kept\n", n, kept.size());
+    failed = 1;
+  }
+  unlink(bin);
+  unlink(csv);
+
+  printf("%u records, %zu kept, %u dropped, %ld bytes (%.2f per record); "
+         "%lu drains, %lu returned an error; %lu writes cut short, %lu "
+         "failed\n",
+         records, kept.size(), (unsigned)telemetry.dropped(), bytes,
+         kept.size() ? (double)bytes / kept.size() : 0.0, drains, errors,
+         file.shortened, file.failed);
+  return failed;
+}